@@ -0,0 +1,136 @@
+#include "ujcommon.h"
+
+/* Returns the FNV-1a hash of the letter counts of a signature
+ */
+static uint32_t signature_hash(const Signature* signature) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < ALPHASIZE; i++) {
+        hash = (hash ^ signature->counts[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* Returns the slot of the table holding the class of signature, or the
+ * empty slot it would be stored in
+ */
+static int anagram_slot(const AnagramTable* table,
+        const Signature* signature) {
+    int slot = signature_hash(signature) & (table->capacity - 1);
+    while (table->slots[slot] >= 0 && memcmp(
+            table->keys[table->slots[slot]].counts, signature->counts,
+            ALPHASIZE)) {
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    return slot;
+}
+
+/* Groups the words of a dictionary into anagram classes (words with exactly
+ * the same letter counts) and stores the table in the dictionary. Words of
+ * a class are kept in dictionary order.
+ */
+void anagram_build(Dictionary* dictionary) {
+    AnagramTable* table = calloc(1, sizeof(AnagramTable));
+    table->capacity = 1024;
+    while (table->capacity < dictionary->size * 2) {
+        table->capacity *= 2;
+    }
+    table->slots = malloc(sizeof(int) * table->capacity);
+    memset(table->slots, -1, sizeof(int) * table->capacity);
+    table->keys = malloc(sizeof(Signature) * dictionary->size);
+    table->starts = calloc(dictionary->size + 1, sizeof(int));
+    int* classOf = malloc(sizeof(int) * dictionary->size);
+    for (int i = 0; i < dictionary->size; i++) {
+        int slot = anagram_slot(table, &dictionary->signatures[i]);
+        if (table->slots[slot] < 0) { // First word of a new class
+            table->slots[slot] = table->classes;
+            table->keys[table->classes++] = dictionary->signatures[i];
+        }
+        classOf[i] = table->slots[slot];
+        table->starts[classOf[i] + 1]++;
+    }
+    for (int c = 0; c < table->classes; c++) { // Counts to starts
+        table->starts[c + 1] += table->starts[c];
+    }
+    int* fill = malloc(sizeof(int) * table->classes);
+    memcpy(fill, table->starts, sizeof(int) * table->classes);
+    table->words = malloc(sizeof(int) * dictionary->size);
+    for (int i = 0; i < dictionary->size; i++) {
+        table->words[fill[classOf[i]]++] = i;
+    }
+    free(fill);
+    free(classOf);
+    dictionary->anagrams = table;
+}
+
+/* Returns the number of sub-multisets of the query letters, the number of
+ * probes anagram_lookup would make (capped at limit + 1)
+ */
+int anagram_probes(const Query* query, int limit) {
+    int probes = 1;
+    for (int i = 0; i < ALPHASIZE && probes <= limit; i++) {
+        probes *= query->letters.counts[i] + 1;
+    }
+    return probes;
+}
+
+/*
+ * This struct stores the state of one anagram_lookup, the sub-multiset
+ * being built and the word positions found so far
+ */
+typedef struct Probe {
+    const AnagramTable* table;
+    const Query* query;
+    Signature current;
+    int* found;
+    int size;
+    int capacity;
+} Probe;
+
+/* Chooses every count from 0 to the query count of letters letter onwards,
+ * probing the table once all letters are chosen
+ */
+static void anagram_probe(Probe* probe, int letter, int length) {
+    while (letter < ALPHASIZE && !probe->query->letters.counts[letter]) {
+        letter++;
+    }
+    if (letter == ALPHASIZE) {
+        // Words need 3 letters plus their '\n' (see word_is_valid)
+        if (length < 3 || (signature_mask(&probe->current) &
+                probe->query->includeMask) != probe->query->includeMask) {
+            return;
+        }
+        const AnagramTable* table = probe->table;
+        int class = table->slots[anagram_slot(table, &probe->current)];
+        if (class < 0) {
+            return;
+        }
+        int count = table->starts[class + 1] - table->starts[class];
+        while (probe->size + count > probe->capacity) {
+            int capacity = probe->capacity ? probe->capacity * 2 : 64;
+            probe->found = arena_grow(probe->query->arena, probe->found,
+                    sizeof(int) * probe->capacity, sizeof(int) * capacity);
+            probe->capacity = capacity;
+        }
+        memcpy(probe->found + probe->size,
+                table->words + table->starts[class], sizeof(int) * count);
+        probe->size += count;
+        return;
+    }
+    for (int n = 0; n <= probe->query->letters.counts[letter]; n++) {
+        probe->current.counts[letter] = n;
+        anagram_probe(probe, letter + 1, length + n);
+    }
+    probe->current.counts[letter] = 0;
+}
+
+/* Returns the words of a dictionary which fit query by probing its anagram
+ * table with every sub-multiset of the query letters, in dictionary order
+ */
+StringArray* anagram_lookup(Dictionary* dictionary, const Query* query) {
+    Probe probe;
+    memset(&probe, 0, sizeof(Probe));
+    probe.table = dictionary->anagrams;
+    probe.query = query;
+    anagram_probe(&probe, 0, 0);
+    return positions_to_words(dictionary, query, probe.found, probe.size);
+}
@@ -0,0 +1,83 @@
+#include "ujcommon.h"
+
+/* Rounds size up to a multiple of ARENAALIGN
+ */
+static size_t arena_round(size_t size) {
+    return (size + ARENAALIGN - 1) & ~(size_t)(ARENAALIGN - 1);
+}
+
+/* Returns a new empty arena, its first block is only allocated once
+ * something is allocated from it
+ */
+Arena* arena_create(void) {
+    return calloc(1, sizeof(Arena));
+}
+
+/* Returns size bytes from the arena, adding a block at least twice as large
+ * as the last one when the current block is full. The memory lives until
+ * the arena is reset or destroyed.
+ */
+void* arena_alloc(Arena* arena, size_t size) {
+    size = arena_round(size);
+    ArenaBlock* block = arena->head;
+    if (block == NULL || block->used + size > block->size) {
+        size_t blockSize = block ? block->size * 2 : ARENABLOCK;
+        while (blockSize < size) {
+            blockSize *= 2;
+        }
+        block = malloc(sizeof(ArenaBlock) + blockSize);
+        block->size = blockSize;
+        block->used = 0;
+        block->next = arena->head;
+        arena->head = block;
+    }
+    arena->last = block->data + block->used;
+    block->used += size;
+    return arena->last;
+}
+
+/* Resizes memory from arena_alloc from oldSize to newSize bytes, in place
+ * if it is the most recent allocation and its block has room, else by
+ * copying it to a new allocation
+ */
+void* arena_grow(Arena* arena, void* memory, size_t oldSize,
+        size_t newSize) {
+    ArenaBlock* block = arena->head;
+    if (memory != NULL && memory == arena->last &&
+            (char*)memory + arena_round(newSize) <= block->data +
+            block->size) {
+        block->used = (char*)memory - block->data + arena_round(newSize);
+        return memory;
+    }
+    void* grown = arena_alloc(arena, newSize);
+    if (memory != NULL) {
+        memcpy(grown, memory, oldSize);
+    }
+    return grown;
+}
+
+/* Releases everything allocated from the arena in one go. The largest
+ * (most recent) block is kept so the next query does not need malloc.
+ */
+void arena_reset(Arena* arena) {
+    if (arena->head == NULL) {
+        return;
+    }
+    ArenaBlock* block = arena->head->next;
+    while (block != NULL) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head->next = NULL;
+    arena->head->used = 0;
+    arena->last = NULL;
+}
+
+/* Frees the arena and every block it owns
+ */
+void arena_destroy(Arena* arena) {
+    arena_reset(arena);
+    free(arena->head);
+    free(arena);
+}
@@ -0,0 +1,178 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<spawn.h>
+#include<sys/wait.h>
+#include<sys/resource.h>
+
+#define BENCHMODES 5
+
+extern char** environ;
+
+/*
+ * This struct stores the options of a benchmark mode, include is set if the
+ * first query letter is passed to -include
+ */
+typedef struct BenchMode {
+    char* name;
+    char* option;
+    int include;
+} BenchMode;
+
+static const BenchMode modes[BENCHMODES] = {
+    {"default", NULL, 0},
+    {"alpha", "-alpha", 0},
+    {"len", "-len", 0},
+    {"longest", "-longest", 0},
+    {"include", "-include", 1},
+};
+
+/* Relative frequency of letters "a" to "z" in English text, per 1000
+ */
+static const int frequencies[26] = {82, 15, 28, 43, 127, 22, 20, 61, 70, 2,
+        8, 40, 24, 67, 75, 19, 1, 60, 63, 91, 28, 10, 24, 2, 20, 1};
+
+/* Fills letters with length random letters drawn with English letter
+ * frequencies, so generated queries match as real ones would
+ */
+static void letters_generate(char* letters, int length) {
+    int total = 0;
+    for (int i = 0; i < 26; i++) {
+        total += frequencies[i];
+    }
+    for (int i = 0; i < length; i++) {
+        int pick = rand() % total;
+        int letter = 0;
+        while (pick >= frequencies[letter]) {
+            pick -= frequencies[letter++];
+        }
+        letters[i] = 'a' + letter;
+    }
+    letters[length] = '\0';
+}
+
+/* Takes double pointers and returns the order between them
+ */
+static int double_compare(const void* p1, const void* p2) {
+    double difference = *(const double*)p1 - *(const double*)p2;
+    return (difference > 0) - (difference < 0);
+}
+
+/* Runs unjumble once with its output discarded, stores its peak RSS (KiB)
+ * in rss and returns its wall clock time in milliseconds, -1 if it could
+ * not be run
+ */
+static double bench_run(char** argv, long* rss) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+            O_WRONLY, 0);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid;
+    if (posix_spawn(&pid, argv[0], &actions, NULL, argv, environ)) {
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    posix_spawn_file_actions_destroy(&actions);
+    *rss = usage.ru_maxrss;
+    // Exit status 10 (nothing matched) is a normal result
+    if (!WIFEXITED(status) || (WEXITSTATUS(status) &&
+            WEXITSTATUS(status) != 10)) {
+        return -1;
+    }
+    return (end.tv_sec - start.tv_sec) * 1e3 +
+            (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+/* Runs every query through one mode against one dictionary and prints the
+ * results as a line of JSON. Returns 0 if every run succeeded.
+ */
+static int bench_mode(char* program, char* dictionary, const BenchMode* mode,
+        char** queries, int count) {
+    double* times = malloc(sizeof(double) * count);
+    double total = 0;
+    long peakRss = 0;
+    for (int q = 0; q < count; q++) {
+        char include[2] = {queries[q][0], '\0'};
+        char* argv[6];
+        int argc = 0;
+        argv[argc++] = program;
+        if (mode->option) {
+            argv[argc++] = mode->option;
+        }
+        if (mode->include) {
+            argv[argc++] = include;
+        }
+        argv[argc++] = queries[q];
+        argv[argc++] = dictionary;
+        argv[argc] = NULL;
+        long rss;
+        times[q] = bench_run(argv, &rss);
+        if (times[q] < 0) {
+            fprintf(stderr, "bench_unjumble: \"%s\" failed on \"%s\"\n",
+                    program, queries[q]);
+            free(times);
+            return 1;
+        }
+        total += times[q];
+        peakRss = rss > peakRss ? rss : peakRss;
+    }
+    qsort(times, count, sizeof(double), double_compare);
+    printf("{\"dictionary\": \"%s\", \"mode\": \"%s\", \"queries\": %d, "
+            "\"qps\": %.2f, \"p50_ms\": %.3f, \"p99_ms\": %.3f, "
+            "\"peak_rss_kb\": %ld}\n", dictionary, mode->name, count,
+            count / (total / 1e3), times[count / 2],
+            times[(count * 99 - 1) / 100], peakRss);
+    fflush(stdout);
+    free(times);
+    return 0;
+}
+
+/* Benchmarks unjumble. Usage: ujbench [-length n] [-queries n] [-seed n]
+ * program dictionary... Generates the queries once then runs them through
+ * every mode against each dictionary, printing one JSON line per pair.
+ */
+int main(int argc, char** argv) {
+    int length = 7;
+    int count = 200;
+    unsigned seed = 2310;
+    int i = 1;
+    for (; i < argc - 1 && argv[i][0] == '-'; i += 2) {
+        if (!strcmp(argv[i], "-length")) {
+            length = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "-queries")) {
+            count = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "-seed")) {
+            seed = atoi(argv[i + 1]);
+        } else {
+            break;
+        }
+    }
+    if (argc - i < 2 || length < 3 || count < 1) {
+        fprintf(stderr, "Usage: ujbench [-length n] [-queries n] [-seed n] "
+                "program dictionary...\n");
+        return 1;
+    }
+    srand(seed);
+    char** queries = malloc(sizeof(char*) * count);
+    for (int q = 0; q < count; q++) {
+        queries[q] = malloc(length + 1);
+        letters_generate(queries[q], length);
+    }
+    int failed = 0;
+    for (int d = i + 1; d < argc; d++) {
+        for (int m = 0; m < BENCHMODES; m++) {
+            failed |= bench_mode(argv[i], argv[d], &modes[m], queries,
+                    count);
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,205 @@
+#include "ujcommon.h"
+#include<unistd.h>
+#include<sys/file.h>
+#include<sys/stat.h>
+
+/* Returns the FNV-1a hash of size bytes of text
+ */
+static uint64_t block_checksum(char* text, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+/* Returns where the block of text beginning at start ends, just after the
+ * first '\n' at least CACHEBLOCK bytes on, or at the end of text. Blocks
+ * start on a line so each parses exactly as it would within all of text.
+ */
+static size_t block_end(char* text, size_t size, size_t start) {
+    if (size - start <= CACHEBLOCK) {
+        return size;
+    }
+    char* from = text + start + CACHEBLOCK - 1;
+    char* newline = memchr(from, '\n', text + size - from);
+    return newline ? newline - text + 1 : size;
+}
+
+/* Makes room in the arrays of a dictionary for extra more words
+ */
+static void dictionary_reserve(Dictionary* dictionary, int* capacity,
+        int extra) {
+    if (dictionary->size + extra <= *capacity) {
+        return;
+    }
+    while (dictionary->size + extra > *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 1024;
+    }
+    dictionary->signatures = realloc(dictionary->signatures,
+            sizeof(Signature) * *capacity);
+    dictionary->masks = realloc(dictionary->masks,
+            sizeof(uint32_t) * *capacity);
+    dictionary->offsets = realloc(dictionary->offsets,
+            sizeof(uint32_t) * *capacity);
+    dictionary->lengths = realloc(dictionary->lengths, *capacity);
+    dictionary->keys = realloc(dictionary->keys,
+            sizeof(uint64_t) * *capacity);
+}
+
+/* Reads the words of block from the cache onto the end of dictionary.
+ * Returns 0 (leaving dictionary as it was) if the block no longer matches
+ * the dictionary text: it must follow on from the blocks before it and,
+ * unless the source is unchanged since the cache was written (trusted),
+ * its checksum must still match. A block without a final '\n' is only
+ * valid at the end of text, else words were appended to its last line.
+ */
+static int block_read(FILE* cache, CacheBlock* block, Dictionary* dictionary,
+        int* capacity, size_t start, int trusted) {
+    size_t end = block->start + block->length;
+    if (block->start != start || !block->length ||
+            end > dictionary->textSize || block->words > block->length ||
+            (dictionary->text[end - 1] != '\n' &&
+            end != dictionary->textSize) ||
+            (!trusted && block_checksum(dictionary->text + start,
+            block->length) != block->checksum)) {
+        return 0;
+    }
+    dictionary_reserve(dictionary, capacity, block->words);
+    int first = dictionary->size;
+    if (fread(dictionary->signatures + first, sizeof(Signature),
+            block->words, cache) != block->words ||
+            fread(dictionary->keys + first, sizeof(uint64_t),
+            block->words, cache) != block->words ||
+            fread(dictionary->masks + first, sizeof(uint32_t),
+            block->words, cache) != block->words ||
+            fread(dictionary->offsets + first, sizeof(uint32_t),
+            block->words, cache) != block->words ||
+            fread(dictionary->lengths + first, 1, block->words, cache) !=
+            block->words) {
+        return 0;
+    }
+    for (int i = first; i < first + (int)block->words; i++) {
+        dictionary->offsets[i] += start; // Offsets within all of text
+    }
+    dictionary->size += block->words;
+    return 1;
+}
+
+/* Parses the block of text from start to end onto the end of dictionary
+ * and appends its record to the cache
+ */
+static void block_write(FILE* cache, Dictionary* dictionary, int* capacity,
+        size_t start, size_t end) {
+    Dictionary* part = dictionary_parse(dictionary->text + start,
+            end - start);
+    CacheBlock block;
+    block.start = start;
+    block.checksum = block_checksum(dictionary->text + start, end - start);
+    block.length = end - start;
+    block.words = part->size;
+    fwrite(&block, sizeof(CacheBlock), 1, cache);
+    fwrite(part->signatures, sizeof(Signature), part->size, cache);
+    fwrite(part->keys, sizeof(uint64_t), part->size, cache);
+    fwrite(part->masks, sizeof(uint32_t), part->size, cache);
+    fwrite(part->offsets, sizeof(uint32_t), part->size, cache);
+    fwrite(part->lengths, 1, part->size, cache);
+    dictionary_reserve(dictionary, capacity, part->size);
+    int first = dictionary->size;
+    memcpy(dictionary->signatures + first, part->signatures,
+            sizeof(Signature) * part->size);
+    memcpy(dictionary->masks + first, part->masks,
+            sizeof(uint32_t) * part->size);
+    memcpy(dictionary->lengths + first, part->lengths, part->size);
+    memcpy(dictionary->keys + first, part->keys,
+            sizeof(uint64_t) * part->size);
+    for (int i = 0; i < part->size; i++) {
+        dictionary->offsets[first + i] = start + part->offsets[i];
+    }
+    dictionary->size += part->size;
+    free(part->signatures);
+    free(part->masks);
+    free(part->offsets);
+    free(part->lengths);
+    free(part->keys);
+    free(part);
+}
+
+/* Returns the words of the mapped plain dictionary text, reading the
+ * signatures of every block still unchanged from the cache file next to
+ * argDictionary (see CACHESUFFIX). Only the blocks from the first changed
+ * one onwards are parsed again and the cache is cut back and appended to
+ * there, so appending words to a dictionary only parses what was added.
+ * Returns NULL if argDictionary is not a regular file or its cache can not
+ * be opened, the caller then parses the dictionary itself.
+ */
+Dictionary* cache_load(char* argDictionary, char* text, size_t size) {
+    struct stat info;
+    char path[PATH_MAX];
+    if (stat(argDictionary, &info) || !S_ISREG(info.st_mode) ||
+            snprintf(path, sizeof(path), "%s%s", argDictionary,
+            CACHESUFFIX) >= (int)sizeof(path)) {
+        return NULL;
+    }
+    FILE* cache = fopen(path, "r+b");
+    if (cache == NULL) {
+        cache = fopen(path, "w+b");
+    }
+    if (cache == NULL) {
+        return NULL;
+    }
+    flock(fileno(cache), LOCK_EX); // Other loaders may be updating it
+    CacheHeader header;
+    if (fread(&header, sizeof(CacheHeader), 1, cache) != 1 ||
+            strncmp(header.magic, CACHEMAGIC, sizeof(header.magic)) ||
+            header.version != CACHEVERSION) {
+        memset(&header, 0, sizeof(CacheHeader)); // Rebuilt from scratch
+    }
+    int trusted = header.sourceSize == size &&
+            header.sourceSeconds == info.st_mtim.tv_sec &&
+            header.sourceNanoseconds == info.st_mtim.tv_nsec;
+    Dictionary* dictionary = calloc(1, sizeof(Dictionary));
+    dictionary->text = text;
+    dictionary->textSize = size;
+    int capacity = 0;
+    uint32_t blocks = 0;
+    size_t start = 0; // End of the text covered by the blocks kept
+    long kept = sizeof(CacheHeader);
+    CacheBlock block;
+    while (blocks < header.blocks &&
+            fread(&block, sizeof(CacheBlock), 1, cache) == 1 &&
+            block_read(cache, &block, dictionary, &capacity, start,
+            trusted)) {
+        start += block.length;
+        blocks++;
+        kept = ftell(cache);
+    }
+    if (!trusted || blocks < header.blocks || start < size) {
+        fflush(cache);
+        if (ftruncate(fileno(cache), kept) || fseek(cache, kept, SEEK_SET)) {
+            fclose(cache); // Read only cache, parse without it
+            free(dictionary->signatures);
+            free(dictionary->masks);
+            free(dictionary->offsets);
+            free(dictionary->lengths);
+            free(dictionary->keys);
+            free(dictionary);
+            return NULL;
+        }
+        for (size_t end; start < size; start = end, blocks++) {
+            end = block_end(text, size, start);
+            block_write(cache, dictionary, &capacity, start, end);
+        }
+        memset(&header, 0, sizeof(CacheHeader));
+        strcpy(header.magic, CACHEMAGIC);
+        header.version = CACHEVERSION;
+        header.blocks = blocks;
+        header.sourceSize = size;
+        header.sourceSeconds = info.st_mtim.tv_sec;
+        header.sourceNanoseconds = info.st_mtim.tv_nsec;
+        rewind(cache);
+        fwrite(&header, sizeof(CacheHeader), 1, cache);
+    }
+    fclose(cache);
+    return dictionary;
+}
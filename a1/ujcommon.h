@@ -0,0 +1,390 @@
+#ifndef UJCOMMON
+#define UJCOMMON
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<ctype.h>
+#include<stdint.h>
+#include<limits.h>
+
+#define ALPHASIZE 26
+#define SIGNATURESIZE 32
+#define MATCHBATCH 1024
+#define MAXTHREADS 256
+#define MAXDICTIONARIES 16
+#define ANAGRAMRATIO 16
+#define STREAMBUFFER 65536
+#define ARENABLOCK 65536
+#define ARENAALIGN 16
+#define SERVERWORKERS 4
+#define SERVERBACKLOG 64
+#define SERVERTIMEOUT 30
+#define MAXWORDLEN 50
+#define BLANK '?'
+#define INDEXMAGIC "UJINDEX"
+#define INDEXVERSION 7
+#define INDEXALIGN 32
+#define CACHEMAGIC "UJCACHE"
+#define CACHEVERSION 2
+#define CACHESUFFIX ".ujcache"
+#define CACHEBLOCK 65536
+#define RESULTMAGIC "UJRESLT"
+#define RESULTVERSION 1
+#define RESULTSUFFIX ".ujresults"
+#define RESULTKEYSIZE 256
+#define RESULTCACHEKB 1024
+
+/*
+ * This struct is a view of a word inside a mapped dictionary, the text is not
+ * '\0' terminated and length includes the trailing '\n' (if any). key holds
+ * its first 8 characters case folded (see word_key).
+ */
+typedef struct Word {
+    char* text;
+    int length;
+    uint64_t key;
+} Word;
+
+/* Returns the number of c (0 for "a" to 25 for "z") if it is an ASCII
+ * letter of either case, -1 otherwise. Unlike isalpha and tolower this
+ * never consults the locale.
+ */
+static inline int letter_of(char c) {
+    unsigned letter = ((unsigned char)c | 0x20) - 'a';
+    return letter < ALPHASIZE ? (int)letter : -1;
+}
+
+/* Returns c in lower case if it is an ASCII upper case letter, else c
+ */
+static inline unsigned char letter_fold(char c) {
+    return c >= 'A' && c <= 'Z' ? c | 0x20 : (unsigned char)c;
+}
+
+/*
+ * This struct stores a list of words, size of said list and the number of
+ * words allocated for it
+ */
+typedef struct StringArray {
+    Word* words;
+    int size;
+    int capacity;
+} StringArray;
+
+/*
+ * This struct stores the number of occurrences of letters "a" to "z" in a
+ * word, packed one byte per letter and zero padded to SIGNATURESIZE bytes so
+ * it can be compared in one vector
+ */
+typedef struct Signature {
+    unsigned char counts[SIGNATURESIZE];
+} Signature;
+
+/*
+ * This struct is one block of an Arena, data is handed out from the start
+ * and used bytes of it are taken
+ */
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+    char data[] __attribute__((aligned(ARENAALIGN)));
+} ArenaBlock;
+
+/*
+ * This struct owns every allocation of a query, they are all released at
+ * once by arena_reset. last is the most recent allocation (it can grow in
+ * place).
+ */
+typedef struct Arena {
+    ArenaBlock* head;
+    void* last;
+} Arena;
+
+/*
+ * This struct stores what a dictionary word is matched against, the
+ * signature of the query letters, a mask with bit n set iff letter n is in
+ * the query and the mask of letters every word must contain (-include).
+ * blanks is the number of BLANK tiles, each can stand in for any letter a
+ * word needs more of than the query has, tiles counts letters and blanks.
+ * Only the longest words are kept if longest is set (-longest) and only
+ * the top best words by order if top is not 0 (-top). If stream
+ * is not NULL words are written to it as they are found rather than kept
+ * (-stream).
+ * Everything the query allocates comes from arena.
+ */
+typedef struct Query {
+    Signature letters;
+    uint32_t lettersMask;
+    uint32_t includeMask;
+    int blanks;
+    int tiles;
+    int longest;
+    int top;
+    int (*order)(const void* p1, const void* p2);
+    FILE* stream;
+    Arena* arena;
+} Query;
+
+/*
+ * A match kernel stores the positions of the signatures which fit within
+ * a query in matches and returns how many there were. Words whose masks
+ * have more letters outside the query than it has blanks are rejected
+ * before counts are compared.
+ */
+typedef int (*MatchKernel)(const Signature* signatures, const uint32_t* masks,
+        int count, const Query* query, int* matches);
+
+/*
+ * This struct groups the words of a dictionary by anagram class. slots is
+ * an open addressed hash table of class numbers (-1 if empty) keyed by the
+ * class signature in keys, the words of class c are the dictionary
+ * positions words[starts[c]] to words[starts[c + 1] - 1].
+ */
+typedef struct AnagramTable {
+    int capacity;
+    int classes;
+    int* slots;
+    Signature* keys;
+    int* starts;
+    int* words;
+} AnagramTable;
+
+/*
+ * This struct is a node of a Trie, letter is 0 to 25 and word is the first
+ * dictionary position ending here (-1 if none). Children form a list
+ * through sibling, 0 ends a list as the root is never a child.
+ */
+typedef struct TrieNode {
+    int child;
+    int sibling;
+    int word;
+    unsigned char letter;
+} TrieNode;
+
+/*
+ * This struct stores the case folded words of a dictionary as a trie, next
+ * chains the dictionary positions which end at the same node (-1 ends it)
+ */
+typedef struct Trie {
+    int size;
+    int capacity;
+    TrieNode* nodes;
+    int* next;
+} Trie;
+
+/*
+ * This struct stores every usable word of a dictionary alongside its
+ * signature and sort key (see word_key), both worked out once when the
+ * dictionary is parsed so queries never fold case. Words are views into
+ * text, which is either the mapped dictionary or the pool of a mapped
+ * index, and text holds them in dictionary order. Positions are grouped
+ * by length (see dictionary_bucket), the words of length l are positions
+ * buckets[l] to buckets[l + 1] - 1 in dictionary order. anagrams and trie
+ * are only built (by anagram_build and trie_build) for dictionaries which
+ * answer many queries.
+ */
+typedef struct Dictionary {
+    int size;
+    Signature* signatures;
+    uint32_t* masks;
+    uint32_t* offsets;
+    unsigned char* lengths;
+    uint64_t* keys;
+    char* text;
+    uint64_t textSize;
+    int buckets[MAXWORDLEN + 1];
+    AnagramTable* anagrams;
+    Trie* trie;
+} Dictionary;
+
+/*
+ * This struct is stored at the start of every index file, it is followed by
+ * the path of the dictionary it was built from (sourceLength bytes padded to
+ * INDEXALIGN), the signatures, keys, masks, offsets and lengths of a
+ * Dictionary (grouped by length as per buckets) then its pool of words in
+ * dictionary order. It is padded to 256 bytes so the signatures stay
+ * aligned.
+ */
+typedef struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t size;
+    uint64_t textSize;
+    uint32_t buckets[MAXWORDLEN + 1];
+    uint32_t sourceLength;
+    uint32_t reserved[6];
+} IndexHeader;
+
+/*
+ * This struct is stored at the start of a signature cache (-cache), it
+ * records the size and modification time of the dictionary when the cache
+ * was last brought up to date and how many blocks follow it
+ */
+typedef struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t blocks;
+    uint64_t sourceSize;
+    int64_t sourceSeconds;
+    int64_t sourceNanoseconds;
+} CacheHeader;
+
+/*
+ * This struct precedes the words of one block of a signature cache, the
+ * dictionary text from start (on a line) for length bytes with the given
+ * checksum. It is followed by the signatures, keys, masks, offsets (within
+ * the block) and lengths of its words.
+ */
+typedef struct CacheBlock {
+    uint64_t start;
+    uint64_t checksum;
+    uint32_t length;
+    uint32_t words;
+} CacheBlock;
+
+/*
+ * This struct is one cached answer of a ResultCache, the key of a query
+ * (see result_cache_key) against the dictionaries with the given id
+ * followed in data by the words it printed. newer and older link the
+ * entries in order of use, chain links the entries of one hash bucket.
+ */
+typedef struct ResultEntry {
+    struct ResultEntry* newer;
+    struct ResultEntry* older;
+    struct ResultEntry* chain;
+    uint64_t id;
+    uint32_t keyLength;
+    uint32_t valueLength;
+    char data[];
+} ResultEntry;
+
+/*
+ * This struct is a least recently used cache of query answers (-cache),
+ * kept in the file at path between runs. It holds at most limit bytes of
+ * keys and words and counts its hits and misses.
+ */
+typedef struct ResultCache {
+    char path[PATH_MAX];
+    size_t limit;
+    size_t bytes;
+    int count;
+    int capacity;
+    ResultEntry** table;
+    ResultEntry* newest;
+    ResultEntry* oldest;
+    uint64_t hits;
+    uint64_t misses;
+} ResultCache;
+
+/*
+ * This struct is stored at the start of a results cache file, it is
+ * followed by entries records, least recently used first, each a
+ * ResultRecord then its key and words
+ */
+typedef struct ResultHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t entries;
+    uint64_t hits;
+    uint64_t misses;
+} ResultHeader;
+
+/*
+ * This struct precedes the key and words of one entry of a results cache
+ * file
+ */
+typedef struct ResultRecord {
+    uint64_t id;
+    uint32_t keyLength;
+    uint32_t valueLength;
+} ResultRecord;
+
+// Function prototypes from unjumble.c
+char* init_dictionary(char* argDictionary, size_t* size);
+int word_is_valid(char* word, int length);
+StringArray* unjumble_mode(int mode, int top, StringArray* a);
+int string_compare(const void* p1, const void* p2);
+int int_compare(const void* p1, const void* p2);
+int check_letters(char* letters, FILE* stream);
+void print_words(StringArray* a, FILE* stream);
+// End function prototypes from unjumble.c
+
+// Function prototypes from ujindex.c
+char* map_file(char* path, size_t* size);
+void signature_compute(char* word, int length, Signature* signature);
+uint32_t signature_mask(const Signature* signature);
+Dictionary* dictionary_parse(char* text, size_t size);
+void dictionary_bucket(Dictionary* dictionary);
+int* dictionary_order(Dictionary* dictionary);
+Dictionary* dictionary_load(char* argDictionary, int threads, int cache);
+void build_index(char* argDictionary, char* argIndex);
+Dictionary* read_index(char* argDictionary, char* text, size_t size);
+void query_compute(char* letters, char includeLetter, Arena* arena,
+        Query* query);
+uint64_t word_key(char* text, int length);
+void match_range(Dictionary* dictionary, const Query* query, int start,
+        int end, StringArray* a);
+StringArray* positions_to_words(Dictionary* dictionary, const Query* query,
+        int* positions, int size);
+StringArray* unjumble_dictionary(Dictionary* dictionary, Query* query,
+        int threads);
+// End function prototypes from ujindex.c
+
+// Function prototypes from ujthread.c
+Dictionary* dictionary_parse_threaded(char* text, size_t size, int threads);
+StringArray* match_threaded(Dictionary* dictionary, const Query* query,
+        int start, int end, int threads);
+// End function prototypes from ujthread.c
+
+// Function prototypes from ujserver.c
+int unjumble_serve(int argc, char** argv);
+// End function prototypes from ujserver.c
+
+// Function prototypes from ujanagram.c
+void anagram_build(Dictionary* dictionary);
+int anagram_probes(const Query* query, int limit);
+StringArray* anagram_lookup(Dictionary* dictionary, const Query* query);
+// End function prototypes from ujanagram.c
+
+// Function prototypes from ujtrie.c
+void trie_build(Dictionary* dictionary);
+StringArray* trie_lookup(Dictionary* dictionary, const Query* query);
+// End function prototypes from ujtrie.c
+
+// Function prototypes from ujarena.c
+Arena* arena_create(void);
+void* arena_alloc(Arena* arena, size_t size);
+void* arena_grow(Arena* arena, void* memory, size_t oldSize,
+        size_t newSize);
+void arena_reset(Arena* arena);
+void arena_destroy(Arena* arena);
+// End function prototypes from ujarena.c
+
+// Function prototypes from ujfederate.c
+Dictionary* dictionary_federate(char** paths, int count, int threads,
+        int cache);
+// End function prototypes from ujfederate.c
+
+// Function prototypes from ujcache.c
+Dictionary* cache_load(char* argDictionary, char* text, size_t size);
+// End function prototypes from ujcache.c
+
+// Function prototypes from ujresult.c
+ResultCache* result_cache_open(char* argDictionary, size_t limit);
+ResultEntry* result_cache_get(ResultCache* cache, uint64_t id, char* key,
+        int keyLength);
+void result_cache_put(ResultCache* cache, uint64_t id, char* key,
+        int keyLength, StringArray* a);
+void result_cache_close(ResultCache* cache);
+uint64_t result_cache_id(char** dictionaries, int count);
+int result_cache_key(char* letters, char includeLetter, int mode, int top,
+        char* key);
+void result_cache_stats(char* argDictionary);
+// End function prototypes from ujresult.c
+
+// Function prototypes from ujmatch.c
+MatchKernel match_kernel(const Query* query);
+// End function prototypes from ujmatch.c
+
+#endif
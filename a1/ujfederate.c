@@ -0,0 +1,142 @@
+#include "ujcommon.h"
+#include<pthread.h>
+
+/*
+ * This struct stores the work of one loader thread of dictionary_federate
+ */
+typedef struct Member {
+    char* path;
+    int threads;
+    int cache;
+    Dictionary* dictionary;
+} Member;
+
+/* Thread body of dictionary_federate, loads one member dictionary
+ */
+static void* member_load(void* arg) {
+    Member* member = arg;
+    member->dictionary = dictionary_load(member->path, member->threads,
+            member->cache);
+    return NULL;
+}
+
+/* Returns the number of letters in a word, without its '\n' (if any)
+ */
+static int word_letters(char* text, int length) {
+    return length && text[length - 1] == '\n' ? length - 1 : length;
+}
+
+/* Returns the FNV-1a hash of the letters of a word
+ */
+static uint32_t word_hash(char* text, int letters) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < letters; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* Returns the slot of the set of words seen holding word, or the empty slot
+ * (-1) it would be stored in. Slots hold positions in the federated pool.
+ */
+static int seen_slot(int* slots, int capacity, Dictionary* federated,
+        char* text, int letters) {
+    int slot = word_hash(text, letters) & (capacity - 1);
+    while (slots[slot] >= 0) {
+        char* other = federated->text + federated->offsets[slots[slot]];
+        if (word_letters(other, federated->lengths[slots[slot]]) ==
+                letters && !memcmp(other, text, letters)) {
+            break;
+        }
+        slot = (slot + 1) & (capacity - 1);
+    }
+    return slot;
+}
+
+/* Loads count dictionaries (or indexes) concurrently and merges them into
+ * one, keeping the words of each in order after those of the dictionaries
+ * before it. A word already in an earlier dictionary is dropped once here,
+ * so queries never see or scan it twice. Words are copied into a pool of
+ * the merged dictionary in dictionary order, which is then bucketed. The
+ * last word of a dictionary not ending in '\n' is given one. Each
+ * dictionary is read through its signature cache if cache is set.
+ */
+Dictionary* dictionary_federate(char** paths, int count, int threads,
+        int cache) {
+    if (count == 1) {
+        return dictionary_load(paths[0], threads, cache);
+    }
+    Member members[MAXDICTIONARIES];
+    pthread_t loaders[MAXDICTIONARIES];
+    for (int d = 0; d < count; d++) {
+        members[d].path = paths[d];
+        members[d].threads = threads;
+        members[d].cache = cache;
+        pthread_create(&loaders[d], NULL, member_load, &members[d]);
+    }
+    int size = 0;
+    uint64_t textSize = 0;
+    for (int d = 0; d < count; d++) {
+        pthread_join(loaders[d], NULL);
+        size += members[d].dictionary->size;
+        for (int i = 0; i < members[d].dictionary->size; i++) {
+            textSize += members[d].dictionary->lengths[i];
+        }
+    }
+    Dictionary* federated = calloc(1, sizeof(Dictionary));
+    federated->signatures = malloc(sizeof(Signature) * size);
+    federated->masks = malloc(sizeof(uint32_t) * size);
+    federated->offsets = malloc(sizeof(uint32_t) * size);
+    federated->lengths = malloc(size);
+    federated->keys = malloc(sizeof(uint64_t) * size);
+    federated->text = malloc(textSize + count); // Room for each final '\n'
+    int capacity = 1024;
+    while (capacity < size * 2) {
+        capacity *= 2;
+    }
+    int* slots = malloc(sizeof(int) * capacity);
+    memset(slots, -1, sizeof(int) * capacity);
+    for (int d = 0; d < count; d++) {
+        Dictionary* member = members[d].dictionary;
+        int* order = dictionary_order(member);
+        int first = federated->size; // Words of this member are not seen yet
+        for (int k = 0; k < member->size; k++) {
+            int i = order[k];
+            char* text = member->text + member->offsets[i];
+            int letters = word_letters(text, member->lengths[i]);
+            if (d && slots[seen_slot(slots, capacity, federated, text,
+                    letters)] >= 0) {
+                continue; // Already in an earlier dictionary
+            }
+            int word = federated->size++;
+            federated->signatures[word] = member->signatures[i];
+            federated->masks[word] = member->masks[i];
+            federated->offsets[word] = federated->textSize;
+            federated->lengths[word] = member->lengths[i];
+            federated->keys[word] = member->keys[i];
+            memcpy(federated->text + federated->textSize, text,
+                    member->lengths[i]);
+            federated->textSize += member->lengths[i];
+            if (letters == member->lengths[i] &&
+                    member->offsets[i] + letters == member->textSize &&
+                    letters < MAXWORDLEN - 1) {
+                // Last word of a file without a final '\n', which would
+                // otherwise run into the first word of the next one
+                federated->text[federated->textSize++] = '\n';
+                federated->lengths[word]++;
+            }
+        }
+        free(order);
+        for (int word = first; word < federated->size; word++) {
+            char* text = federated->text + federated->offsets[word];
+            int slot = seen_slot(slots, capacity, federated, text,
+                    word_letters(text, federated->lengths[word]));
+            if (slots[slot] < 0) {
+                slots[slot] = word;
+            }
+        }
+    }
+    free(slots);
+    dictionary_bucket(federated);
+    return federated;
+}
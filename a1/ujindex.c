@@ -0,0 +1,661 @@
+#include "ujcommon.h"
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+/* Maps the file at path read-only into memory and stores its size. Files
+ * which can not be mapped (pipes, empty files) are read into the heap
+ * instead. Returns NULL if the file can not be opened.
+ */
+char* map_file(char* path, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    char* text = MAP_FAILED;
+    if (!fstat(fd, &info) && S_ISREG(info.st_mode) && info.st_size > 0) {
+        *size = info.st_size;
+        text = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (text == MAP_FAILED) { // Fall back to reading the whole file
+        size_t capacity = 4096;
+        ssize_t got;
+        text = malloc(capacity);
+        *size = 0;
+        while ((got = read(fd, text + *size, capacity - *size)) > 0) {
+            *size += got;
+            if (*size == capacity) {
+                capacity *= 2;
+                text = realloc(text, capacity);
+            }
+        }
+    }
+    close(fd);
+    return text;
+}
+
+/* Fills signature with the number of occurrences of letters "a" to "z" in
+ * the first length characters of word, counts saturate at 255
+ */
+void signature_compute(char* word, int length, Signature* signature) {
+    memset(signature, 0, sizeof(Signature));
+    for (int i = 0; i < length; i++) {
+        int letter = letter_of(word[i]);
+        if (letter >= 0) {
+            unsigned char* count = &signature->counts[letter];
+            if (*count < UCHAR_MAX) {
+                (*count)++;
+            }
+        }
+    }
+}
+
+/* Returns a mask with bit n set iff letter n occurs in the signature
+ */
+uint32_t signature_mask(const Signature* signature) {
+    uint32_t mask = 0;
+    for (int i = 0; i < ALPHASIZE; i++) {
+        if (signature->counts[i]) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
+
+/* Splits mapped dictionary text into words the same way fgets would with a
+ * MAXWORDLEN buffer and keeps a view, signature and sort key of every
+ * usable word. This is the only pass which validates or case folds words.
+ * Arrays grow geometrically, words themselves are never copied.
+ */
+Dictionary* dictionary_parse(char* text, size_t size) {
+    Dictionary* dictionary = calloc(1, sizeof(Dictionary));
+    dictionary->text = text;
+    dictionary->textSize = size;
+    int capacity = 0;
+    size_t position = 0;
+    while (position < size) {
+        char* word = text + position;
+        size_t limit = size - position;
+        if (limit > MAXWORDLEN - 1) {
+            limit = MAXWORDLEN - 1;
+        }
+        char* newline = memchr(word, '\n', limit);
+        int length = newline ? newline - word + 1 : limit;
+        position += length;
+        if (!word_is_valid(word, length)) {
+            continue;
+        }
+        if (dictionary->size == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            dictionary->signatures = realloc(dictionary->signatures,
+                    sizeof(Signature) * capacity);
+            dictionary->masks = realloc(dictionary->masks,
+                    sizeof(uint32_t) * capacity);
+            dictionary->offsets = realloc(dictionary->offsets,
+                    sizeof(uint32_t) * capacity);
+            dictionary->lengths = realloc(dictionary->lengths, capacity);
+            dictionary->keys = realloc(dictionary->keys,
+                    sizeof(uint64_t) * capacity);
+        }
+        signature_compute(word, length,
+                &dictionary->signatures[dictionary->size]);
+        dictionary->masks[dictionary->size] =
+                signature_mask(&dictionary->signatures[dictionary->size]);
+        dictionary->offsets[dictionary->size] = word - text;
+        dictionary->lengths[dictionary->size] = length;
+        dictionary->keys[dictionary->size] = word_key(word, length);
+        dictionary->size++;
+    }
+    return dictionary;
+}
+
+/* Reorders the words of a parsed dictionary by length and fills its
+ * buckets (see Dictionary). The sort is stable so every length keeps
+ * dictionary order. Scans can then skip every word too long for a query.
+ */
+void dictionary_bucket(Dictionary* dictionary) {
+    int fill[MAXWORDLEN + 1];
+    memset(dictionary->buckets, 0, sizeof(dictionary->buckets));
+    for (int i = 0; i < dictionary->size; i++) {
+        dictionary->buckets[dictionary->lengths[i] + 1]++;
+    }
+    for (int l = 0; l < MAXWORDLEN; l++) { // Counts to starts
+        dictionary->buckets[l + 1] += dictionary->buckets[l];
+    }
+    memcpy(fill, dictionary->buckets, sizeof(fill));
+    Signature* signatures = malloc(sizeof(Signature) * dictionary->size);
+    uint32_t* masks = malloc(sizeof(uint32_t) * dictionary->size);
+    uint32_t* offsets = malloc(sizeof(uint32_t) * dictionary->size);
+    unsigned char* lengths = malloc(dictionary->size);
+    uint64_t* keys = malloc(sizeof(uint64_t) * dictionary->size);
+    for (int i = 0; i < dictionary->size; i++) {
+        int position = fill[dictionary->lengths[i]]++;
+        signatures[position] = dictionary->signatures[i];
+        masks[position] = dictionary->masks[i];
+        offsets[position] = dictionary->offsets[i];
+        lengths[position] = dictionary->lengths[i];
+        keys[position] = dictionary->keys[i];
+    }
+    free(dictionary->signatures);
+    free(dictionary->masks);
+    free(dictionary->offsets);
+    free(dictionary->lengths);
+    free(dictionary->keys);
+    dictionary->signatures = signatures;
+    dictionary->masks = masks;
+    dictionary->offsets = offsets;
+    dictionary->lengths = lengths;
+    dictionary->keys = keys;
+}
+
+/* Takes uint64_t pointers and returns the order between them
+ */
+static int key_compare(const void* p1, const void* p2) {
+    uint64_t key1 = *(const uint64_t*)p1;
+    uint64_t key2 = *(const uint64_t*)p2;
+    return (key1 > key2) - (key1 < key2);
+}
+
+/* Returns the positions of the words of a dictionary in dictionary order,
+ * the order of their text. The caller frees it.
+ */
+int* dictionary_order(Dictionary* dictionary) {
+    uint64_t* keys = malloc(sizeof(uint64_t) * dictionary->size);
+    for (int i = 0; i < dictionary->size; i++) {
+        keys[i] = (uint64_t)dictionary->offsets[i] << 32 | i;
+    }
+    qsort(keys, dictionary->size, sizeof(uint64_t), key_compare);
+    int* order = malloc(sizeof(int) * dictionary->size);
+    for (int i = 0; i < dictionary->size; i++) {
+        order[i] = keys[i] & UINT32_MAX;
+    }
+    free(keys);
+    return order;
+}
+
+/* Maps the dictionary or index at argDictionary and returns its words,
+ * exit(2) if it can not be opened. Plain dictionaries are read through
+ * their signature cache if cache is set (see cache_load), else parsed by
+ * threads threads, then bucketed by length.
+ */
+Dictionary* dictionary_load(char* argDictionary, int threads, int cache) {
+    size_t size;
+    char* text = init_dictionary(argDictionary, &size);
+    Dictionary* dictionary = read_index(argDictionary, text, size);
+    if (dictionary != NULL) {
+        return dictionary; // Already bucketed
+    }
+    if (cache) {
+        dictionary = cache_load(argDictionary, text, size);
+    }
+    if (dictionary == NULL && threads > 1) {
+        dictionary = dictionary_parse_threaded(text, size, threads);
+    } else if (dictionary == NULL) {
+        dictionary = dictionary_parse(text, size);
+    }
+    dictionary_bucket(dictionary);
+    return dictionary;
+}
+
+/* Returns the number of zero bytes padding the source path of an index of
+ * this length so the signatures after it stay aligned
+ */
+static int index_padding(uint32_t sourceLength) {
+    return (INDEXALIGN - sourceLength % INDEXALIGN) % INDEXALIGN;
+}
+
+/* Writes the index of a dictionary to argIndex, exit(2) if either file can
+ * not be opened. Words are stored bucketed but their pool stays in
+ * dictionary order.
+ */
+void build_index(char* argDictionary, char* argIndex) {
+    Dictionary* dictionary = dictionary_load(argDictionary, 1, 0);
+    FILE* writer = fopen(argIndex, "wb");
+    if (writer == NULL) {
+        fprintf(stderr, "unjumble: file \"%s\" can not be opened\n",
+                argIndex);
+        exit(2);
+    }
+    char source[PATH_MAX]; // Recorded so a damaged index can be rebuilt
+    if (realpath(argDictionary, source) == NULL) {
+        snprintf(source, sizeof(source), "%s", argDictionary);
+    }
+    IndexHeader header;
+    memset(&header, 0, sizeof(IndexHeader));
+    strcpy(header.magic, INDEXMAGIC);
+    header.version = INDEXVERSION;
+    header.size = dictionary->size;
+    header.sourceLength = strlen(source);
+    for (int l = 0; l <= MAXWORDLEN; l++) {
+        header.buckets[l] = dictionary->buckets[l];
+    }
+    int* order = dictionary_order(dictionary);
+    uint32_t* offsets = malloc(sizeof(uint32_t) * dictionary->size);
+    for (int i = 0; i < dictionary->size; i++) { // Offsets within the pool
+        offsets[order[i]] = header.textSize;
+        header.textSize += dictionary->lengths[order[i]];
+    }
+    fwrite(&header, sizeof(IndexHeader), 1, writer);
+    char padding[INDEXALIGN] = {0};
+    fwrite(source, 1, header.sourceLength, writer);
+    fwrite(padding, 1, index_padding(header.sourceLength), writer);
+    fwrite(dictionary->signatures, sizeof(Signature), dictionary->size,
+            writer);
+    fwrite(dictionary->keys, sizeof(uint64_t), dictionary->size, writer);
+    fwrite(dictionary->masks, sizeof(uint32_t), dictionary->size, writer);
+    fwrite(offsets, sizeof(uint32_t), dictionary->size, writer);
+    fwrite(dictionary->lengths, 1, dictionary->size, writer);
+    for (int i = 0; i < dictionary->size; i++) {
+        fwrite(dictionary->text + dictionary->offsets[order[i]], 1,
+                dictionary->lengths[order[i]], writer);
+    }
+    free(offsets);
+    free(order);
+    if (fclose(writer)) {
+        fprintf(stderr, "unjumble: file \"%s\" can not be written\n",
+                argIndex);
+        exit(2);
+    }
+}
+
+/* Returns 1 if every count, bucket and offset of the mapped index text
+ * lies within its size bytes, 0 if the index is truncated or corrupt. Its
+ * magic and version are already checked.
+ */
+static int index_valid(char* text, size_t size) {
+    IndexHeader* header = (IndexHeader*)text;
+    uint64_t words = header->size;
+    uint64_t start = sizeof(IndexHeader) + header->sourceLength +
+            index_padding(header->sourceLength);
+    if (header->sourceLength >= PATH_MAX || words > INT_MAX ||
+            header->textSize > size || start + words *
+            (sizeof(Signature) + sizeof(uint64_t) + 2 * sizeof(uint32_t) + 1)
+            + header->textSize != size) {
+        return 0;
+    }
+    if (header->buckets[0] != 0 || header->buckets[MAXWORDLEN] != words) {
+        return 0;
+    }
+    for (int l = 0; l < MAXWORDLEN; l++) {
+        if (header->buckets[l] > header->buckets[l + 1]) {
+            return 0;
+        }
+    }
+    char* section = text + start + words * (sizeof(Signature) +
+            sizeof(uint64_t) + sizeof(uint32_t));
+    uint32_t* offsets = (uint32_t*)section;
+    unsigned char* lengths = (unsigned char*)(section +
+            sizeof(uint32_t) * words);
+    for (int l = 0; l < MAXWORDLEN; l++) {
+        for (uint32_t i = header->buckets[l]; i < header->buckets[l + 1];
+                i++) {
+            if (lengths[i] != l ||
+                    (uint64_t)offsets[i] + l > header->textSize) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* Reports the damaged index at argDictionary and how to rebuild it, from
+ * the dictionary recorded in it if that path can be read back, then
+ * exit(2). Queries never write the index themselves.
+ */
+static void index_damaged(char* argDictionary, char* text, size_t size) {
+    IndexHeader* header = (IndexHeader*)text;
+    char source[PATH_MAX];
+    uint32_t length = header->sourceLength;
+    if (length >= PATH_MAX || size < sizeof(IndexHeader) + length) {
+        length = 0; // The path itself can not be trusted
+    }
+    memcpy(source, text + sizeof(IndexHeader), length);
+    source[length] = '\0';
+    if (length == 0 || memchr(source, '\0', length)) {
+        fprintf(stderr, "unjumble: index \"%s\" is corrupt, rebuild it "
+                "with -build-index\n", argDictionary);
+    } else {
+        fprintf(stderr, "unjumble: index \"%s\" is corrupt, rebuild it "
+                "with -build-index \"%s\" \"%s\"\n", argDictionary, source,
+                argDictionary);
+    }
+    exit(2);
+}
+
+/* Returns the Dictionary stored in the mapped index text, its arrays point
+ * straight into the mapping. Returns NULL if text is a plain dictionary,
+ * exit(2) if the index is from another version of unjumble or is
+ * truncated or corrupt (see index_damaged).
+ */
+Dictionary* read_index(char* argDictionary, char* text, size_t size) {
+    IndexHeader* header = (IndexHeader*)text;
+    if (size < sizeof(IndexHeader) ||
+            strncmp(header->magic, INDEXMAGIC, sizeof(header->magic))) {
+        return NULL;
+    }
+    if (header->version != INDEXVERSION) {
+        fprintf(stderr, "unjumble: index \"%s\" is out of date\n",
+                argDictionary);
+        exit(2);
+    }
+    if (!index_valid(text, size)) {
+        index_damaged(argDictionary, text, size);
+    }
+    Dictionary* dictionary = calloc(1, sizeof(Dictionary));
+    dictionary->size = header->size;
+    dictionary->textSize = header->textSize;
+    for (int l = 0; l <= MAXWORDLEN; l++) {
+        dictionary->buckets[l] = header->buckets[l];
+    }
+    char* section = text + sizeof(IndexHeader) + header->sourceLength +
+            index_padding(header->sourceLength);
+    dictionary->signatures = (Signature*)section;
+    section += sizeof(Signature) * header->size;
+    dictionary->keys = (uint64_t*)section;
+    section += sizeof(uint64_t) * header->size;
+    dictionary->masks = (uint32_t*)section;
+    section += sizeof(uint32_t) * header->size;
+    dictionary->offsets = (uint32_t*)section;
+    section += sizeof(uint32_t) * header->size;
+    dictionary->lengths = (unsigned char*)section;
+    section += header->size;
+    dictionary->text = section;
+    return dictionary;
+}
+
+/* Fills query with the signature and masks of letters and includeLetter
+ * (if not '\0') and the arena it allocates from, options are left off
+ */
+void query_compute(char* letters, char includeLetter, Arena* arena,
+        Query* query) {
+    memset(query, 0, sizeof(Query));
+    query->arena = arena;
+    signature_compute(letters, strlen(letters), &query->letters);
+    query->lettersMask = signature_mask(&query->letters);
+    query->includeMask = includeLetter ?
+            1u << letter_of(includeLetter) : 0;
+    for (int i = 0; letters[i] != '\0'; i++) {
+        query->blanks += letters[i] == BLANK;
+    }
+    query->tiles = query->blanks;
+    for (int i = 0; i < ALPHASIZE; i++) {
+        query->tiles += query->letters.counts[i];
+    }
+}
+
+/* Returns the first 8 characters of a word case folded and packed so that
+ * comparing keys orders words as strcasecmp would in the C locale
+ */
+uint64_t word_key(char* text, int length) {
+    uint64_t key = 0;
+    for (int j = 0; j < 8; j++) {
+        key <<= 8;
+        if (j < length) {
+            key |= letter_fold(text[j]);
+        }
+    }
+    return key;
+}
+
+/* Adds word to a, a heap of the query->top best words found so far with the
+ * worst at its root. Returns without adding if a is full and word is no
+ * better than the root.
+ */
+static void heap_push(StringArray* a, const Query* query, Word* word) {
+    int i = a->size;
+    if (a->size < query->top) { // Sift up from the end
+        a->size++;
+        while (i && query->order(&a->words[(i - 1) / 2], word) < 0) {
+            a->words[i] = a->words[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+    } else if (query->order(word, &a->words[0]) < 0) { // Sift down
+        i = 0;
+        while (2 * i + 1 < a->size) {
+            int child = 2 * i + 1;
+            if (child + 1 < a->size && query->order(&a->words[child + 1],
+                    &a->words[child]) > 0) {
+                child++;
+            }
+            if (query->order(&a->words[child], word) <= 0) {
+                break;
+            }
+            a->words[i] = a->words[child];
+            i = child;
+        }
+    } else {
+        return;
+    }
+    a->words[i] = *word;
+}
+
+/* Appends the words of dictionary positions start to end which fit the
+ * query to a, in position order. Signatures are compared MATCHBATCH at a
+ * time by kernel. If top is set a is a heap of the query->top best words
+ * (see heap_push). Always inlined into the variants of match_range with top
+ * as a constant, so the loop over the words found has no branch on it.
+ */
+static inline __attribute__((always_inline)) void match_words(
+        Dictionary* dictionary, const Query* query, MatchKernel kernel,
+        int start, int end, StringArray* a, int top) {
+    int matches[MATCHBATCH];
+    for (; start < end; start += MATCHBATCH) {
+        int count = end - start;
+        if (count > MATCHBATCH) {
+            count = MATCHBATCH;
+        }
+        int found = kernel(dictionary->signatures + start,
+                dictionary->masks + start, count, query, matches);
+        if (!top && a->size + found > a->capacity) {
+            int capacity = a->capacity ? a->capacity : 64;
+            while (capacity < a->size + found) {
+                capacity *= 2;
+            }
+            a->words = arena_grow(query->arena, a->words,
+                    sizeof(Word) * a->capacity, sizeof(Word) * capacity);
+            a->capacity = capacity;
+        }
+        for (int i = 0; i < found; i++) {
+            int word = start + matches[i];
+            Word match;
+            match.text = dictionary->text + dictionary->offsets[word];
+            match.length = dictionary->lengths[word];
+            match.key = dictionary->keys[word];
+            if (top) {
+                if (a->size == a->capacity && a->size < query->top) {
+                    int capacity = a->capacity ? a->capacity * 2 : 64;
+                    a->words = arena_grow(query->arena, a->words,
+                            sizeof(Word) * a->capacity,
+                            sizeof(Word) * capacity);
+                    a->capacity = capacity;
+                }
+                heap_push(a, query, &match);
+            } else {
+                a->words[a->size++] = match;
+            }
+        }
+    }
+}
+
+/* Variant of match_range keeping every word found
+ */
+static void match_all(Dictionary* dictionary, const Query* query,
+        MatchKernel kernel, int start, int end, StringArray* a) {
+    match_words(dictionary, query, kernel, start, end, a, 0);
+}
+
+/* Variant of match_range keeping the query->top best words found
+ */
+static void match_top(Dictionary* dictionary, const Query* query,
+        MatchKernel kernel, int start, int end, StringArray* a) {
+    match_words(dictionary, query, kernel, start, end, a, 1);
+}
+
+/* Appends the words of dictionary positions start to end which fit the
+ * query to a, in position order, or keeps a heap of the best query->top of
+ * them (-top). The kernel specialised for the query and the variant for
+ * its output are picked once here rather than tested for every word.
+ */
+void match_range(Dictionary* dictionary, const Query* query, int start,
+        int end, StringArray* a) {
+    MatchKernel kernel = match_kernel(query);
+    if (query->top) {
+        match_top(dictionary, query, kernel, start, end, a);
+    } else {
+        match_all(dictionary, query, kernel, start, end, a);
+    }
+}
+
+/* Takes Word pointers and returns the order of their text, which is
+ * dictionary order
+ */
+static int word_compare(const void* p1, const void* p2) {
+    const Word* word1 = p1;
+    const Word* word2 = p2;
+    return (word1->text > word2->text) - (word1->text < word2->text);
+}
+
+/* Returns the words at the given dictionary positions in dictionary order
+ */
+StringArray* positions_to_words(Dictionary* dictionary, const Query* query,
+        int* positions, int size) {
+    StringArray* a = arena_alloc(query->arena, sizeof(StringArray));
+    a->words = arena_alloc(query->arena, sizeof(Word) * size);
+    a->size = size;
+    a->capacity = size;
+    for (int i = 0; i < size; i++) {
+        a->words[i].text = dictionary->text +
+                dictionary->offsets[positions[i]];
+        a->words[i].length = dictionary->lengths[positions[i]];
+        a->words[i].key = dictionary->keys[positions[i]];
+    }
+    qsort(a->words, size, sizeof(Word), word_compare);
+    return a;
+}
+
+/*
+ * This struct stores the scan of one bucket by match_stream, the next
+ * position to scan up to end and the positions found in the last batch
+ * which are not written yet
+ */
+typedef struct Cursor {
+    int next;
+    int end;
+    int used;
+    int found;
+    int matches[MATCHBATCH];
+} Cursor;
+
+/* Writes the words of buckets 0 to longest which fit query to
+ * query->stream as they are found, in dictionary order. Each bucket is
+ * scanned a batch at a time and the buckets are merged by text order.
+ * Returns the words, which are only counted.
+ */
+static StringArray* match_stream(Dictionary* dictionary, const Query* query,
+        int longest) {
+    MatchKernel kernel = match_kernel(query);
+    Cursor* cursors = arena_alloc(query->arena,
+            sizeof(Cursor) * (longest + 1));
+    for (int l = 0; l <= longest; l++) {
+        cursors[l].next = dictionary->buckets[l];
+        cursors[l].end = dictionary->buckets[l + 1];
+        cursors[l].used = cursors[l].found = 0;
+    }
+    StringArray* a = arena_alloc(query->arena, sizeof(StringArray));
+    memset(a, 0, sizeof(StringArray));
+    while (1) {
+        int best = -1;
+        uint32_t bestOffset = 0;
+        for (int l = 0; l <= longest; l++) {
+            Cursor* cursor = &cursors[l];
+            while (cursor->used == cursor->found &&
+                    cursor->next < cursor->end) { // Scan the next batch
+                int count = cursor->end - cursor->next;
+                if (count > MATCHBATCH) {
+                    count = MATCHBATCH;
+                }
+                cursor->found = kernel(dictionary->signatures + cursor->next,
+                        dictionary->masks + cursor->next, count, query,
+                        cursor->matches);
+                for (int i = 0; i < cursor->found; i++) {
+                    cursor->matches[i] += cursor->next;
+                }
+                cursor->used = 0;
+                cursor->next += count;
+            }
+            if (cursor->used < cursor->found) {
+                uint32_t offset =
+                        dictionary->offsets[cursor->matches[cursor->used]];
+                if (best < 0 || offset < bestOffset) {
+                    best = l;
+                    bestOffset = offset;
+                }
+            }
+        }
+        if (best < 0) {
+            return a;
+        }
+        int word = cursors[best].matches[cursors[best].used++];
+        fwrite(dictionary->text + bestOffset, 1, dictionary->lengths[word],
+                query->stream);
+        a->size++;
+    }
+}
+
+/* Returns the words of dictionary positions start to end which fit query,
+ * in position order, split across threads if there is more than one
+ */
+static StringArray* match_positions(Dictionary* dictionary,
+        const Query* query, int start, int end, int threads) {
+    if (threads > 1) {
+        return match_threaded(dictionary, query, start, end, threads);
+    }
+    StringArray* a = arena_alloc(query->arena, sizeof(StringArray));
+    memset(a, 0, sizeof(StringArray));
+    match_range(dictionary, query, start, end, a);
+    return a;
+}
+
+/* Returns the words of a dictionary which fit query, in dictionary order
+ * unless query keeps only its top words. Words are views into the
+ * dictionary rather than copies. Short queries are looked up in the anagram
+ * table (unless they have blanks) and longer ones walk the trie if the
+ * dictionary has them. Otherwise only the buckets of words no longer than
+ * the query are scanned, split across threads if there is more than one,
+ * and -longest queries stop at the longest bucket with any words. Streamed
+ * queries are always scanned on this thread.
+ */
+StringArray* unjumble_dictionary(Dictionary* dictionary, Query* query,
+        int threads) {
+    int limit = dictionary->size / ANAGRAMRATIO;
+    // Longest word length (with its '\n') the tiles can pay for
+    int longest = query->tiles + 1 < MAXWORDLEN - 1 ? query->tiles + 1 :
+            MAXWORDLEN - 1;
+    if (query->stream) {
+        return match_stream(dictionary, query, longest);
+    } else if (dictionary->anagrams && !query->blanks &&
+            anagram_probes(query, limit) <= limit) {
+        return anagram_lookup(dictionary, query);
+    } else if (dictionary->trie) {
+        return trie_lookup(dictionary, query);
+    }
+    StringArray* a;
+    if (query->longest) {
+        for (int l = longest; l >= 0; l--) {
+            a = match_positions(dictionary, query, dictionary->buckets[l],
+                    dictionary->buckets[l + 1], threads);
+            if (a->size) {
+                break;
+            }
+        }
+        return a; // A single bucket is already in dictionary order
+    }
+    a = match_positions(dictionary, query, 0,
+            dictionary->buckets[longest + 1], threads);
+    if (!query->top && a->size > 1) { // Buckets back to dictionary order
+        qsort(a->words, a->size, sizeof(Word), word_compare);
+    }
+    return a;
+}
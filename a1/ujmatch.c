@@ -0,0 +1,198 @@
+#include "ujcommon.h"
+#include<pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#define UJ_X86
+#endif
+
+/* Kernels are written once as always inlined bodies taking include (the
+ * query has an -include letter) and blanks (it has BLANK tiles) as
+ * constants. MATCH_VARIANTS stamps out one function per combination, so
+ * each compiled loop only tests what its queries need.
+ */
+#define MATCH_VARIANTS(body, target) \
+    target static int body##_plain(const Signature* signatures, \
+            const uint32_t* masks, int count, const Query* query, \
+            int* matches) { \
+        return body(signatures, masks, count, query, matches, 0, 0); \
+    } \
+    target static int body##_include(const Signature* signatures, \
+            const uint32_t* masks, int count, const Query* query, \
+            int* matches) { \
+        return body(signatures, masks, count, query, matches, 1, 0); \
+    } \
+    target static int body##_blanks(const Signature* signatures, \
+            const uint32_t* masks, int count, const Query* query, \
+            int* matches) { \
+        return body(signatures, masks, count, query, matches, 0, 1); \
+    } \
+    target static int body##_both(const Signature* signatures, \
+            const uint32_t* masks, int count, const Query* query, \
+            int* matches) { \
+        return body(signatures, masks, count, query, matches, 1, 1); \
+    }
+
+/* Lists the variants of a kernel in the order match_kernel indexes them
+ */
+#define MATCH_TABLE(body) \
+    {body##_plain, body##_include, body##_blanks, body##_both}
+
+/* Returns 1 if a word with this mask has no more letters outside the
+ * query than it has blanks and every letter the query requires, 0
+ * otherwise. Rejects most words of a dictionary before their counts are
+ * looked at.
+ */
+static inline __attribute__((always_inline)) int mask_fits(uint32_t mask,
+        const Query* query, int include, int blanks) {
+    uint32_t outside = mask & ~query->lettersMask;
+    if (include && (mask & query->includeMask) != query->includeMask) {
+        return 0;
+    }
+    return !outside || (blanks &&
+            __builtin_popcount(outside) <= query->blanks);
+}
+
+/* Returns 1 if the letters a word signature needs beyond the query letters
+ * can be covered by the query blanks, 0 otherwise
+ */
+static inline __attribute__((always_inline)) int signature_fits(
+        const Signature* word, const Query* query, int blanks) {
+    int missing = 0;
+    for (int j = 0; j < ALPHASIZE; j++) {
+        if (word->counts[j] > query->letters.counts[j]) {
+            missing += word->counts[j] - query->letters.counts[j];
+            if (!blanks || missing > query->blanks) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* Plain C kernel, used when the CPU has neither SSE4.1 nor AVX2
+ */
+static inline __attribute__((always_inline)) int match_scalar(
+        const Signature* signatures, const uint32_t* masks, int count,
+        const Query* query, int* matches, int include, int blanks) {
+    int found = 0;
+    for (int i = 0; i < count; i++) {
+        if (mask_fits(masks[i], query, include, blanks) &&
+                signature_fits(&signatures[i], query, blanks)) {
+            matches[found++] = i;
+        }
+    }
+    return found;
+}
+
+MATCH_VARIANTS(match_scalar, )
+
+#ifdef UJ_X86
+/* SSE4.1 kernel, a word fits iff saturating word - letters is zero in both
+ * 16 byte halves of its signature, or failing that if the bytes of the
+ * difference (summed by psadbw) are within the blanks
+ */
+__attribute__((target("sse4.1")))
+static inline __attribute__((always_inline)) int match_sse41(
+        const Signature* signatures, const uint32_t* masks, int count,
+        const Query* query, int* matches, int include, int blanks) {
+    const unsigned char* letters = query->letters.counts;
+    __m128i low = _mm_loadu_si128((const __m128i*)letters);
+    __m128i high = _mm_loadu_si128((const __m128i*)(letters + 16));
+    int found = 0;
+    for (int i = 0; i < count; i++) {
+        if (!mask_fits(masks[i], query, include, blanks)) {
+            continue;
+        }
+        const unsigned char* word = signatures[i].counts;
+        __m128i excessLow = _mm_subs_epu8(
+                _mm_loadu_si128((const __m128i*)word), low);
+        __m128i excessHigh = _mm_subs_epu8(
+                _mm_loadu_si128((const __m128i*)(word + 16)), high);
+        __m128i excess = _mm_or_si128(excessLow, excessHigh);
+        if (!_mm_testz_si128(excess, excess)) {
+            if (!blanks) {
+                continue;
+            }
+            __m128i sums = _mm_add_epi64(
+                    _mm_sad_epu8(excessLow, _mm_setzero_si128()),
+                    _mm_sad_epu8(excessHigh, _mm_setzero_si128()));
+            if (_mm_cvtsi128_si32(sums) + _mm_extract_epi32(sums, 2) >
+                    query->blanks) {
+                continue;
+            }
+        }
+        matches[found++] = i;
+    }
+    return found;
+}
+
+MATCH_VARIANTS(match_sse41, __attribute__((target("sse4.1"))))
+
+/* AVX2 kernel, compares a whole 32 byte signature at once
+ */
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) int match_avx2(
+        const Signature* signatures, const uint32_t* masks, int count,
+        const Query* query, int* matches, int include, int blanks) {
+    __m256i limit = _mm256_loadu_si256(
+            (const __m256i*)query->letters.counts);
+    int found = 0;
+    for (int i = 0; i < count; i++) {
+        if (!mask_fits(masks[i], query, include, blanks)) {
+            continue;
+        }
+        __m256i excess = _mm256_subs_epu8(_mm256_loadu_si256(
+                (const __m256i*)signatures[i].counts), limit);
+        if (!_mm256_testz_si256(excess, excess)) {
+            if (!blanks) {
+                continue;
+            }
+            __m256i sums = _mm256_sad_epu8(excess, _mm256_setzero_si256());
+            __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums),
+                    _mm256_extracti128_si256(sums, 1));
+            if (_mm_cvtsi128_si32(half) + _mm_extract_epi32(half, 2) >
+                    query->blanks) {
+                continue;
+            }
+        }
+        matches[found++] = i;
+    }
+    return found;
+}
+
+MATCH_VARIANTS(match_avx2, __attribute__((target("avx2"))))
+#endif
+
+static const MatchKernel scalarKernels[4] = MATCH_TABLE(match_scalar);
+#ifdef UJ_X86
+static const MatchKernel sse41Kernels[4] = MATCH_TABLE(match_sse41);
+static const MatchKernel avx2Kernels[4] = MATCH_TABLE(match_avx2);
+#endif
+
+/* The kernels of the running CPU, set once by match_detect
+ */
+static const MatchKernel* kernels = scalarKernels;
+static pthread_once_t detected = PTHREAD_ONCE_INIT;
+
+/* Picks the fastest kernels the running CPU supports
+ */
+static void match_detect(void) {
+#ifdef UJ_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernels = avx2Kernels;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        kernels = sse41Kernels;
+    }
+#endif
+}
+
+/* Returns the fastest match kernel the running CPU supports specialised
+ * for query, whether it has an -include letter and whether it has blanks.
+ * CPU detection is only done once (under pthread_once, so -threads workers
+ * may all call this).
+ */
+MatchKernel match_kernel(const Query* query) {
+    pthread_once(&detected, match_detect);
+    return kernels[(query->includeMask != 0) | (query->blanks != 0) << 1];
+}
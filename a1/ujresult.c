@@ -0,0 +1,297 @@
+#include "ujcommon.h"
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/file.h>
+#include<sys/stat.h>
+
+/* Returns the FNV-1a hash of size bytes of data, continuing from hash
+ */
+static uint64_t result_hash(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+/* Returns the bucket of the table an entry with this id and key hashes to
+ */
+static int result_bucket(ResultCache* cache, uint64_t id, char* key,
+        int keyLength) {
+    uint64_t hash = result_hash(14695981039346656037ull, &id, sizeof(id));
+    return result_hash(hash, key, keyLength) & (cache->capacity - 1);
+}
+
+/* Unlinks entry from the recency list of the cache
+ */
+static void result_unlink(ResultCache* cache, ResultEntry* entry) {
+    *(entry->newer ? &entry->newer->older : &cache->newest) = entry->older;
+    *(entry->older ? &entry->older->newer : &cache->oldest) = entry->newer;
+}
+
+/* Links entry into the recency list of the cache as the most recent
+ */
+static void result_link(ResultCache* cache, ResultEntry* entry) {
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    *(cache->newest ? &cache->newest->newer : &cache->oldest) = entry;
+    cache->newest = entry;
+}
+
+/* Doubles the hash table of the cache and rehashes every entry
+ */
+static void result_grow(ResultCache* cache) {
+    free(cache->table);
+    cache->capacity *= 2;
+    cache->table = calloc(cache->capacity, sizeof(ResultEntry*));
+    for (ResultEntry* entry = cache->newest; entry; entry = entry->older) {
+        int bucket = result_bucket(cache, entry->id, entry->data,
+                entry->keyLength);
+        entry->chain = cache->table[bucket];
+        cache->table[bucket] = entry;
+    }
+}
+
+/* Removes entry from the cache and frees it
+ */
+static void result_remove(ResultCache* cache, ResultEntry* entry) {
+    ResultEntry** link = &cache->table[result_bucket(cache, entry->id,
+            entry->data, entry->keyLength)];
+    while (*link != entry) {
+        link = &(*link)->chain;
+    }
+    *link = entry->chain;
+    result_unlink(cache, entry);
+    cache->bytes -= entry->keyLength + entry->valueLength;
+    cache->count--;
+    free(entry);
+}
+
+/* Frees the cache and every entry it holds
+ */
+static void result_free(ResultCache* cache) {
+    while (cache->newest) {
+        result_remove(cache, cache->newest);
+    }
+    free(cache->table);
+    free(cache);
+}
+
+/* Adds an entry holding key and value as the most recent, then evicts the
+ * least recently used entries until the cache fits in its limit again
+ */
+static void result_add(ResultCache* cache, uint64_t id, char* key,
+        int keyLength, char* value, uint32_t valueLength) {
+    if ((size_t)keyLength + valueLength > cache->limit) {
+        return; // Would evict everything and still not fit
+    }
+    if (cache->count >= cache->capacity) {
+        result_grow(cache);
+    }
+    ResultEntry* entry = malloc(sizeof(ResultEntry) + keyLength +
+            valueLength);
+    entry->id = id;
+    entry->keyLength = keyLength;
+    entry->valueLength = valueLength;
+    memcpy(entry->data, key, keyLength);
+    memcpy(entry->data + keyLength, value, valueLength);
+    int bucket = result_bucket(cache, id, key, keyLength);
+    entry->chain = cache->table[bucket];
+    cache->table[bucket] = entry;
+    result_link(cache, entry);
+    cache->bytes += keyLength + valueLength;
+    cache->count++;
+    while (cache->bytes > cache->limit) {
+        result_remove(cache, cache->oldest);
+    }
+}
+
+/* Returns the results cache next to argDictionary (see RESULTSUFFIX)
+ * holding at most limit bytes of keys and words, with the entries and
+ * counters of its file if it has one. Entries larger than limit are
+ * skipped. A missing, unreadable or damaged file gives an empty cache.
+ */
+ResultCache* result_cache_open(char* argDictionary, size_t limit) {
+    ResultCache* cache = calloc(1, sizeof(ResultCache));
+    cache->limit = limit;
+    cache->capacity = 64;
+    cache->table = calloc(cache->capacity, sizeof(ResultEntry*));
+    snprintf(cache->path, sizeof(cache->path), "%s%s", argDictionary,
+            RESULTSUFFIX);
+    FILE* file = fopen(cache->path, "rb");
+    if (file == NULL) {
+        return cache;
+    }
+    flock(fileno(file), LOCK_SH);
+    ResultHeader header;
+    if (fread(&header, sizeof(ResultHeader), 1, file) == 1 &&
+            !strncmp(header.magic, RESULTMAGIC, sizeof(header.magic)) &&
+            header.version == RESULTVERSION) {
+        cache->hits = header.hits;
+        cache->misses = header.misses;
+        ResultRecord record;
+        char* data = NULL;
+        // Entries are stored least recently used first
+        for (uint32_t i = 0; i < header.entries &&
+                fread(&record, sizeof(ResultRecord), 1, file) == 1 &&
+                record.keyLength <= RESULTKEYSIZE; i++) {
+            size_t size = record.keyLength + record.valueLength;
+            if (record.valueLength > limit) {
+                // Too big for this cache (a smaller -cachesize), skip it
+                if (fseek(file, size, SEEK_CUR)) {
+                    break;
+                }
+                continue;
+            }
+            data = realloc(data, size);
+            if (fread(data, 1, size, file) != size) {
+                break;
+            }
+            result_add(cache, record.id, data, record.keyLength,
+                    data + record.keyLength, record.valueLength);
+        }
+        free(data);
+    }
+    fclose(file);
+    return cache;
+}
+
+/* Returns the cached words for key against the dictionaries with this id
+ * (see result_cache_id) and makes them the most recently used, NULL if
+ * they are not cached. Counts the hit or miss.
+ */
+ResultEntry* result_cache_get(ResultCache* cache, uint64_t id, char* key,
+        int keyLength) {
+    ResultEntry* entry = cache->table[result_bucket(cache, id, key,
+            keyLength)];
+    while (entry && (entry->id != id || entry->keyLength != keyLength ||
+            memcmp(entry->data, key, keyLength))) {
+        entry = entry->chain;
+    }
+    if (entry == NULL) {
+        cache->misses++;
+        return NULL;
+    }
+    cache->hits++;
+    result_unlink(cache, entry);
+    result_link(cache, entry);
+    return entry;
+}
+
+/* Caches the words of a as the answer to key against the dictionaries with
+ * this id, evicting the least recently used answers if need be
+ */
+void result_cache_put(ResultCache* cache, uint64_t id, char* key,
+        int keyLength, StringArray* a) {
+    size_t size = 0;
+    for (int i = 0; i < a->size; i++) {
+        size += a->words[i].length;
+    }
+    if (size > cache->limit) {
+        return;
+    }
+    char* value = malloc(size + 1);
+    char* end = value;
+    for (int i = 0; i < a->size; i++) {
+        memcpy(end, a->words[i].text, a->words[i].length);
+        end += a->words[i].length;
+    }
+    result_add(cache, id, key, keyLength, value, size);
+    free(value);
+}
+
+/* Writes the cache back to its file, least recently used first, then frees
+ * it. The cache is best effort: it is not saved if the file can not be
+ * written, and concurrent runs simply keep the entries of the last to
+ * finish.
+ */
+void result_cache_close(ResultCache* cache) {
+    int fd = open(cache->path, O_WRONLY | O_CREAT, 0644);
+    FILE* file = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (file != NULL) {
+        flock(fd, LOCK_EX);
+        struct stat info;
+        if (!fstat(fd, &info)) {
+            ResultHeader header;
+            memset(&header, 0, sizeof(ResultHeader));
+            strcpy(header.magic, RESULTMAGIC);
+            header.version = RESULTVERSION;
+            header.entries = cache->count;
+            header.hits = cache->hits;
+            header.misses = cache->misses;
+            fwrite(&header, sizeof(ResultHeader), 1, file);
+            for (ResultEntry* entry = cache->oldest; entry;
+                    entry = entry->newer) {
+                ResultRecord record;
+                record.id = entry->id;
+                record.keyLength = entry->keyLength;
+                record.valueLength = entry->valueLength;
+                fwrite(&record, sizeof(ResultRecord), 1, file);
+                fwrite(entry->data, 1, entry->keyLength + entry->valueLength,
+                        file);
+            }
+            fflush(file);
+            if (ftell(file) < info.st_size) { // Only cut back if it shrank
+                ftruncate(fd, ftell(file));
+            }
+        }
+        fclose(file);
+    } else if (fd >= 0) {
+        close(fd);
+    }
+    result_free(cache);
+}
+
+/* Returns an id for a set of dictionaries which changes whenever any of
+ * them is replaced or edited, from their paths, sizes and modification
+ * times
+ */
+uint64_t result_cache_id(char** dictionaries, int count) {
+    uint64_t id = 14695981039346656037ull;
+    for (int d = 0; d < count; d++) {
+        struct stat info;
+        memset(&info, 0, sizeof(info));
+        stat(dictionaries[d], &info);
+        id = result_hash(id, dictionaries[d], strlen(dictionaries[d]) + 1);
+        id = result_hash(id, &info.st_size, sizeof(info.st_size));
+        id = result_hash(id, &info.st_mtim, sizeof(info.st_mtim));
+    }
+    return id;
+}
+
+/* Fills key (RESULTKEYSIZE bytes) with the canonical form of a query, its
+ * letters case folded and sorted (so every anagram of them shares it) then
+ * its options. Returns its length, -1 if the letters are too long to cache.
+ */
+int result_cache_key(char* letters, char includeLetter, int mode, int top,
+        char* key) {
+    int counts[ALPHASIZE + 1] = {0}; // Blanks are counted last
+    if (strlen(letters) > RESULTKEYSIZE - 32) {
+        return -1;
+    }
+    for (int i = 0; letters[i] != '\0'; i++) {
+        int letter = letter_of(letters[i]);
+        counts[letter < 0 ? ALPHASIZE : letter]++;
+    }
+    int length = 0;
+    for (int i = 0; i <= ALPHASIZE; i++) {
+        for (int j = 0; j < counts[i]; j++) {
+            key[length++] = i < ALPHASIZE ? 'a' + i : BLANK;
+        }
+    }
+    return length + snprintf(key + length, 32, " %c %d %d",
+            includeLetter ? letter_fold(includeLetter) : '-', mode, top);
+}
+
+/* Prints the counters and size of the results cache next to argDictionary
+ */
+void result_cache_stats(char* argDictionary) {
+    ResultCache* cache = result_cache_open(argDictionary, SIZE_MAX);
+    size_t lookups = cache->hits + cache->misses;
+    printf("hits %llu misses %llu hit rate %.1f%% entries %d bytes %zu\n",
+            (unsigned long long)cache->hits,
+            (unsigned long long)cache->misses,
+            lookups ? 100.0 * cache->hits / lookups : 0.0, cache->count,
+            cache->bytes);
+    result_free(cache);
+}
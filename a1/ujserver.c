@@ -0,0 +1,233 @@
+#include "ujcommon.h"
+#include<pthread.h>
+#include<signal.h>
+#include<unistd.h>
+#include<netdb.h>
+#include<sys/socket.h>
+#include<sys/time.h>
+#include<sys/un.h>
+#include<netinet/in.h>
+
+/*
+ * This struct stores the state shared by the server and its workers, the
+ * resident dictionary and a ring of accepted clients waiting for a worker
+ */
+typedef struct Server {
+    Dictionary* dictionary;
+    int clients[SERVERBACKLOG];
+    int head;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t waiting;
+    pthread_cond_t space;
+} Server;
+
+/* Creates a socket listening on address, a path (containing '/') for a
+ * Unix socket or else a localhost TCP port. The bound port is printed to
+ * stderr. Exits with status 2 on failure.
+ */
+static int socket_create(char* address) {
+    int sockfd;
+    if (strchr(address, '/')) { // Unix socket
+        struct sockaddr_un ad;
+        memset(&ad, 0, sizeof(struct sockaddr_un));
+        ad.sun_family = AF_UNIX;
+        strncpy(ad.sun_path, address, sizeof(ad.sun_path) - 1);
+        unlink(address);
+        sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sockfd < 0 || bind(sockfd, (struct sockaddr*)&ad,
+                sizeof(struct sockaddr_un))) {
+            sockfd = -1;
+        }
+    } else { // TCP port on localhost
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(struct addrinfo));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        struct addrinfo* ai = NULL;
+        sockfd = -1;
+        if (!getaddrinfo("localhost", address, &hints, &ai)) {
+            sockfd = socket(AF_INET, SOCK_STREAM, 0);
+            int reuse = 1;
+            setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse,
+                    sizeof(int));
+            if (sockfd < 0 || bind(sockfd, ai->ai_addr, ai->ai_addrlen)) {
+                sockfd = -1;
+            }
+            freeaddrinfo(ai);
+        }
+        struct sockaddr_in ad;
+        socklen_t len = sizeof(struct sockaddr_in);
+        if (sockfd >= 0 &&
+                !getsockname(sockfd, (struct sockaddr*)&ad, &len)) {
+            fprintf(stderr, "%d\n", ntohs(ad.sin_port));
+        }
+    }
+    if (sockfd < 0 || listen(sockfd, SERVERBACKLOG) < 0) {
+        fprintf(stderr, "unjumble: unable to open socket for listening\n");
+        exit(2);
+    }
+    return sockfd;
+}
+
+/* Parses a query line "[-alpha|-len|-longest] [-include letter] letters"
+ * into its letters and include letter ('\0' if none). Returns the mode (see
+ * get_mode), 0 if the line is malformed.
+ */
+static int query_parse(char* line, char** letters, char* includeLetter) {
+    int mode = 4;
+    char* save;
+    *letters = NULL;
+    *includeLetter = '\0';
+    for (char* token = strtok_r(line, " \t\r\n", &save); token != NULL;
+            token = strtok_r(NULL, " \t\r\n", &save)) {
+        if (*letters != NULL) { // Letters must be last
+            return 0;
+        } else if (!strcmp(token, "-alpha") && mode == 4) {
+            mode = 1;
+        } else if (!strcmp(token, "-len") && mode == 4) {
+            mode = 2;
+        } else if (!strcmp(token, "-longest") && mode == 4) {
+            mode = 3;
+        } else if (!strcmp(token, "-include")) {
+            token = strtok_r(NULL, " \t\r\n", &save);
+            if (token == NULL || letter_of(token[0]) < 0 ||
+                    token[1] != '\0') {
+                return 0;
+            }
+            *includeLetter = token[0];
+        } else if (token[0] == '-') {
+            return 0;
+        } else {
+            *letters = token;
+        }
+    }
+    return *letters != NULL ? mode : 0;
+}
+
+/* Answers every query line a client sends until it disconnects or sends
+ * nothing for SERVERTIMEOUT seconds. Each answer is the matched words (or an
+ * error line) followed by an empty line.
+ */
+static void client_serve(Dictionary* dictionary, int clientfd) {
+    struct timeval timeout = {.tv_sec = SERVERTIMEOUT};
+    setsockopt(clientfd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+            sizeof(timeout));
+    int writerfd = dup(clientfd);
+    FILE* reader = fdopen(clientfd, "r");
+    FILE* writer = writerfd < 0 ? NULL : fdopen(writerfd, "w");
+    if (reader == NULL || writer == NULL) { // Out of descriptors or memory
+        if (reader) {
+            fclose(reader);
+        } else {
+            close(clientfd);
+        }
+        if (writer) {
+            fclose(writer);
+        } else if (writerfd >= 0) {
+            close(writerfd);
+        }
+        return;
+    }
+    Arena* arena = arena_create();
+    char* line = NULL;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, reader) >= 0) {
+        char* letters;
+        char includeLetter;
+        int mode = query_parse(line, &letters, &includeLetter);
+        if (!mode) {
+            fprintf(writer, "Usage: [-alpha|-len|-longest] "
+                    "[-include letter] letters\n");
+        } else if (!check_letters(letters, writer)) {
+            Query query;
+            query_compute(letters, includeLetter, arena, &query);
+            query.longest = mode == 3;
+            StringArray* a = unjumble_mode(mode, 0,
+                    unjumble_dictionary(dictionary, &query, 1));
+            print_words(a, writer);
+            arena_reset(arena);
+        }
+        fprintf(writer, "\n");
+        if (fflush(writer)) { // Client has gone away
+            break;
+        }
+    }
+    free(line);
+    arena_destroy(arena);
+    fclose(writer);
+    fclose(reader);
+}
+
+/* Thread body of a server worker, serves clients one at a time as they are
+ * accepted
+ */
+static void* worker(void* arg) {
+    Server* server = arg;
+    while (1) {
+        pthread_mutex_lock(&server->lock);
+        while (!server->count) {
+            pthread_cond_wait(&server->waiting, &server->lock);
+        }
+        int clientfd = server->clients[server->head];
+        server->head = (server->head + 1) % SERVERBACKLOG;
+        server->count--;
+        pthread_cond_signal(&server->space);
+        pthread_mutex_unlock(&server->lock);
+        client_serve(server->dictionary, clientfd);
+    }
+    return NULL;
+}
+
+/* Loads the dictionary (last argument) once and answers queries on the
+ * socket before it with a pool of -workers threads (SERVERWORKERS if not
+ * given). Only returns (with status 1) on bad arguments.
+ */
+int unjumble_serve(int argc, char** argv) {
+    int workers = SERVERWORKERS;
+    if (argc == 6 && !strcmp(argv[2], "-workers")) {
+        char* end;
+        workers = strtol(argv[3], &end, 10);
+        if (*end != '\0') {
+            workers = 0;
+        }
+    }
+    if ((argc != 4 && argc != 6) || (argc == 6 &&
+            strcmp(argv[2], "-workers")) || workers < 1 ||
+            workers > MAXTHREADS) {
+        fprintf(stderr, "Usage: unjumble -serve [-workers n] "
+                "port|socketpath dictionary\n");
+        return 1;
+    }
+    Server* server = calloc(1, sizeof(Server));
+    server->dictionary = dictionary_load(argv[argc - 1], 1, 0);
+    anagram_build(server->dictionary);
+    trie_build(server->dictionary);
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->waiting, NULL);
+    pthread_cond_init(&server->space, NULL);
+    int sockfd = socket_create(argv[argc - 2]);
+    signal(SIGPIPE, SIG_IGN); // Clients leaving mid answer are not fatal
+    for (int i = 0; i < workers; i++) {
+        pthread_t thread;
+        pthread_create(&thread, NULL, worker, server);
+        pthread_detach(thread);
+    }
+    while (1) {
+        int clientfd = accept(sockfd, NULL, NULL);
+        if (clientfd < 0) {
+            continue;
+        }
+        pthread_mutex_lock(&server->lock);
+        while (server->count == SERVERBACKLOG) {
+            pthread_cond_wait(&server->space, &server->lock);
+        }
+        server->clients[(server->head + server->count) % SERVERBACKLOG] =
+                clientfd;
+        server->count++;
+        pthread_cond_signal(&server->waiting);
+        pthread_mutex_unlock(&server->lock);
+    }
+    return 0;
+}
@@ -0,0 +1,131 @@
+#include "ujcommon.h"
+#include<pthread.h>
+
+/*
+ * This struct stores the work of one thread, the section of a dictionary it
+ * parses or scans and the words it produced
+ */
+typedef struct Chunk {
+    char* text;
+    size_t size;
+    Dictionary* dictionary;
+    Query query;
+    int start;
+    int end;
+    StringArray words;
+} Chunk;
+
+/* Thread body of dictionary_parse_threaded, parses one chunk of text
+ */
+static void* parse_chunk(void* arg) {
+    Chunk* chunk = arg;
+    chunk->dictionary = dictionary_parse(chunk->text, chunk->size);
+    return NULL;
+}
+
+/* Splits mapped dictionary text into threads line aligned chunks, parses
+ * them concurrently then joins their words back together in dictionary
+ * order. Chunks start after a '\n' so words are split exactly as
+ * dictionary_parse would split them.
+ */
+Dictionary* dictionary_parse_threaded(char* text, size_t size, int threads) {
+    Chunk chunks[MAXTHREADS];
+    pthread_t workers[MAXTHREADS];
+    size_t start = 0;
+    for (int t = 0; t < threads; t++) {
+        size_t end = size;
+        if (t < threads - 1) { // Move the split to just after a '\n'
+            end = size / threads * (t + 1);
+            if (end < start) {
+                end = start;
+            }
+            char* newline = memchr(text + end, '\n', size - end);
+            end = newline ? newline - text + 1 : size;
+        }
+        chunks[t].text = text + start;
+        chunks[t].size = end - start;
+        pthread_create(&workers[t], NULL, parse_chunk, &chunks[t]);
+        start = end;
+    }
+    Dictionary* dictionary = calloc(1, sizeof(Dictionary));
+    dictionary->text = text;
+    dictionary->textSize = size;
+    for (int t = 0; t < threads; t++) {
+        pthread_join(workers[t], NULL);
+        dictionary->size += chunks[t].dictionary->size;
+    }
+    dictionary->signatures = malloc(sizeof(Signature) * dictionary->size);
+    dictionary->masks = malloc(sizeof(uint32_t) * dictionary->size);
+    dictionary->offsets = malloc(sizeof(uint32_t) * dictionary->size);
+    dictionary->lengths = malloc(dictionary->size);
+    dictionary->keys = malloc(sizeof(uint64_t) * dictionary->size);
+    int position = 0;
+    for (int t = 0; t < threads; t++) {
+        Dictionary* part = chunks[t].dictionary;
+        memcpy(dictionary->signatures + position, part->signatures,
+                sizeof(Signature) * part->size);
+        memcpy(dictionary->masks + position, part->masks,
+                sizeof(uint32_t) * part->size);
+        memcpy(dictionary->lengths + position, part->lengths, part->size);
+        memcpy(dictionary->keys + position, part->keys,
+                sizeof(uint64_t) * part->size);
+        uint32_t base = chunks[t].text - text;
+        for (int i = 0; i < part->size; i++) { // Offsets within all of text
+            dictionary->offsets[position + i] = base + part->offsets[i];
+        }
+        position += part->size;
+        free(part->signatures);
+        free(part->masks);
+        free(part->offsets);
+        free(part->lengths);
+        free(part->keys);
+        free(part);
+    }
+    return dictionary;
+}
+
+/* Thread body of match_threaded, scans one range of a dictionary into an
+ * arena of its own
+ */
+static void* match_chunk(void* arg) {
+    Chunk* chunk = arg;
+    memset(&chunk->words, 0, sizeof(StringArray));
+    chunk->query.arena = arena_create();
+    match_range(chunk->dictionary, &chunk->query, chunk->start, chunk->end,
+            &chunk->words);
+    return NULL;
+}
+
+/* Returns the words of dictionary positions start to end which fit query,
+ * scanning threads equal ranges of them concurrently. Results of each range
+ * are appended in order so the output is identical to a single threaded
+ * scan.
+ */
+StringArray* match_threaded(Dictionary* dictionary, const Query* query,
+        int start, int end, int threads) {
+    Chunk chunks[MAXTHREADS];
+    pthread_t workers[MAXTHREADS];
+    for (int t = 0; t < threads; t++) {
+        chunks[t].dictionary = dictionary;
+        chunks[t].query = *query;
+        chunks[t].start = start + (int64_t)(end - start) * t / threads;
+        chunks[t].end = start + (int64_t)(end - start) * (t + 1) / threads;
+        pthread_create(&workers[t], NULL, match_chunk, &chunks[t]);
+    }
+    StringArray* a = arena_alloc(query->arena, sizeof(StringArray));
+    a->size = 0;
+    for (int t = 0; t < threads; t++) {
+        pthread_join(workers[t], NULL);
+        a->size += chunks[t].words.size;
+    }
+    a->words = arena_alloc(query->arena, sizeof(Word) * a->size);
+    a->capacity = a->size;
+    int position = 0;
+    for (int t = 0; t < threads; t++) {
+        memcpy(a->words + position, chunks[t].words.words,
+                sizeof(Word) * chunks[t].words.size);
+        position += chunks[t].words.size;
+        arena_destroy(chunks[t].query.arena);
+    }
+    return a;
+}
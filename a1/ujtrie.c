@@ -0,0 +1,123 @@
+#include "ujcommon.h"
+
+/* Returns the child of node for letter, adding it if add is set. Returns 0
+ * (the root, which is never a child) if there is no such child.
+ */
+static int trie_child(Trie* trie, int node, unsigned char letter, int add) {
+    int child = trie->nodes[node].child;
+    while (child && trie->nodes[child].letter != letter) {
+        child = trie->nodes[child].sibling;
+    }
+    if (child || !add) {
+        return child;
+    }
+    if (trie->size == trie->capacity) {
+        trie->capacity *= 2;
+        trie->nodes = realloc(trie->nodes,
+                sizeof(TrieNode) * trie->capacity);
+    }
+    child = trie->size++;
+    trie->nodes[child].letter = letter;
+    trie->nodes[child].child = 0;
+    trie->nodes[child].word = -1;
+    trie->nodes[child].sibling = trie->nodes[node].child;
+    trie->nodes[node].child = child;
+    return child;
+}
+
+/* Compiles the words of a dictionary, case folded, into a trie and stores
+ * it in the dictionary. Words which only differ in case share a node.
+ */
+void trie_build(Dictionary* dictionary) {
+    Trie* trie = malloc(sizeof(Trie));
+    trie->capacity = 4096;
+    trie->size = 1;
+    trie->nodes = malloc(sizeof(TrieNode) * trie->capacity);
+    memset(&trie->nodes[0], 0, sizeof(TrieNode));
+    trie->nodes[0].word = -1;
+    trie->next = malloc(sizeof(int) * dictionary->size);
+    for (int i = 0; i < dictionary->size; i++) {
+        char* word = dictionary->text + dictionary->offsets[i];
+        int node = 0;
+        for (int j = 0; j < dictionary->lengths[i] && word[j] != '\n'; j++) {
+            node = trie_child(trie, node, letter_of(word[j]), 1);
+        }
+        trie->next[i] = trie->nodes[node].word;
+        trie->nodes[node].word = i;
+    }
+    dictionary->trie = trie;
+}
+
+/*
+ * This struct stores the state of one trie_lookup, the letters and blanks
+ * left to spend and the word positions found so far
+ */
+typedef struct Walk {
+    const Trie* trie;
+    Arena* arena;
+    Signature remaining;
+    int blanks;
+    int include;
+    int* found;
+    int size;
+    int capacity;
+} Walk;
+
+/* Visits every child of node whose letter is still remaining (or can be
+ * paid for with a blank), collecting the words that end at each. included
+ * is set once the -include letter has been spent on the way down.
+ */
+static void trie_walk(Walk* walk, int node, int included) {
+    const TrieNode* nodes = walk->trie->nodes;
+    for (int child = nodes[node].child; child;
+            child = nodes[child].sibling) {
+        unsigned char letter = nodes[child].letter;
+        int blank = !walk->remaining.counts[letter];
+        if (blank && !walk->blanks) {
+            continue;
+        }
+        int nowIncluded = included || letter == walk->include;
+        for (int word = nodes[child].word; word >= 0 && nowIncluded;
+                word = walk->trie->next[word]) {
+            if (walk->size == walk->capacity) {
+                int capacity = walk->capacity ? walk->capacity * 2 : 64;
+                walk->found = arena_grow(walk->arena, walk->found,
+                        sizeof(int) * walk->capacity, sizeof(int) * capacity);
+                walk->capacity = capacity;
+            }
+            walk->found[walk->size++] = word;
+        }
+        if (blank) {
+            walk->blanks--;
+        } else {
+            walk->remaining.counts[letter]--;
+        }
+        trie_walk(walk, child, nowIncluded);
+        if (blank) {
+            walk->blanks++;
+        } else {
+            walk->remaining.counts[letter]++;
+        }
+    }
+}
+
+/* Returns the words of a dictionary which fit query by walking only the
+ * branches of its trie the query letters can pay for, in dictionary order.
+ * Every word in the trie is already long enough (see word_is_valid).
+ */
+StringArray* trie_lookup(Dictionary* dictionary, const Query* query) {
+    Walk walk;
+    memset(&walk, 0, sizeof(Walk));
+    walk.trie = dictionary->trie;
+    walk.arena = query->arena;
+    walk.remaining = query->letters;
+    walk.blanks = query->blanks;
+    walk.include = -1;
+    for (int i = 0; i < ALPHASIZE; i++) {
+        if (query->includeMask & (1u << i)) {
+            walk.include = i;
+        }
+    }
+    trie_walk(&walk, 0, walk.include < 0);
+    return positions_to_words(dictionary, query, walk.found, walk.size);
+}
@@ -1,30 +1,23 @@
-#include<stdio.h>
-#include<stdlib.h>
-#include<string.h>
-#include<ctype.h>
+#include "ujcommon.h"
 
-#define ALPHASIZE 26
-#define MAXWORDLEN 50
-
-typedef struct StringArray {
-    char** words;
-    int size;
-} StringArray;
-
-/* Gets the numbers of arguments at the end of the set of arguments
+/* Gets the numbers of dictionary arguments at the end of the set of
+ * arguments (those after letters)
 */
 int get_arg_has_dictionary(int argc, char** argv) {
     int hasDictionary = 0;
     int endParams = 0;
     for (int i = 1; i < argc; i++) {
         if (argv[i][0] != '-') {
-            if (strcmp(argv[i - 1], "-include")) {
+            if (strcmp(argv[i - 1], "-include") &&
+                    strcmp(argv[i - 1], "-threads") &&
+                    strcmp(argv[i - 1], "-top") &&
+                    strcmp(argv[i - 1], "-cachesize")) {
                 endParams++;
             }
         }
     }
-    if (endParams == 2) {
-        hasDictionary++;
+    if (endParams > 1) {
+        hasDictionary = endParams - 1;
     }
     return hasDictionary;
 }
@@ -38,54 +31,92 @@ char get_arg_include_letter(int argc, char** argv) {
             includeLetter = argv[i + 1][0];
         }
     }
-    if (isalpha(includeLetter) || includeLetter == '\0') {
+    if (letter_of(includeLetter) >= 0 || includeLetter == '\0') {
         return includeLetter;
     } else {
         fprintf(stderr, "Usage: unjumble [-alpha|-len|-longest] " 
-                "[-include letter] letters [dictionary]\n");
+                "[-include letter] [-threads n] [-top k] [-stream] "
+                "[-cache] [-cachesize kb] letters [dictionary...]\n");
         exit(1);
     }
 }
 
-/* Gets & verifies the "letters" argument
+/* Gets the number immediately proceeding option (-threads, -top or
+ * -cachesize), fallback if there is none
  */
-char* get_arg_letters(int argc, char** argv) {
+int get_arg_number(int argc, char** argv, char* option, int fallback) {
+    int number = fallback;
+    for (int i = 1; i < argc - 1; i++) {
+        if (!strcmp(argv[i], option)) {
+            number = atoi(argv[i + 1]);
+        }
+    }
+    return number;
+}
+
+/* Returns 1 if flag (-stream or -cache) was given, 0 otherwise
+ */
+int get_arg_flag(int argc, char** argv, char* flag) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], flag)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Verifies a set of letters, prints why they can not be unjumbled to
+ * stream and returns the matching exit status (3 or 4), 0 if they are fine.
+ * BLANK tiles count as letters.
+ */
+int check_letters(char* letters, FILE* stream) {
     // Integer stores length of letters argument during loop
     int argLettersLength = 0;
     // Integer stores number of non-alphabetical characters in letters argument
     int argLettersNonAlpha = 0;
-    // Determine whether dictionary argument is present
-    int hasDictionary = get_arg_has_dictionary(argc, argv);
     // Loop through the characters of the letters argument until \0
-    for (int i = 0; argv[argc - (1 + hasDictionary)][i] != '\0'; i++) {
+    for (int i = 0; letters[i] != '\0'; i++) {
         argLettersLength++;
-        if (!isalpha(argv[argc - (1 + hasDictionary)][i]) != 0) {
+        if (letter_of(letters[i]) < 0 && letters[i] != BLANK) {
             argLettersNonAlpha++;
         }
     }
     if (argLettersLength < 3) {
         // If length of letters argument is less than 3
-        fprintf(stderr, "unjumble: must supply at least three letters\n");
-        exit(3);
+        fprintf(stream, "unjumble: must supply at least three letters\n");
+        return 3;
     } else if (argLettersNonAlpha > 0) {
         // If there exists a non-alphabetical character
-        fprintf(stderr, "unjumble: can only unjumble alphabetic characters\n");
-        exit(4);
-    } else {
-        // If everything is right, return
-        return argv[argc - (1 + hasDictionary)];
+        fprintf(stream, "unjumble: can only unjumble alphabetic characters\n");
+        return 4;
     }
+    return 0;
 }
 
-/* Gets the "dictionary" argument
+/* Gets & verifies the "letters" argument
  */
-char* get_arg_dictionary(int argc, char** argv) {
-    char* fallback = calloc(25, sizeof(char));
-    fallback = "/usr/share/dict/words";
-    if (get_arg_has_dictionary(argc, argv)) {
-        return argv[argc - 1];
+char* get_arg_letters(int argc, char** argv) {
+    // Determine whether dictionary argument is present
+    int hasDictionary = get_arg_has_dictionary(argc, argv);
+    char* letters = argv[argc - (1 + hasDictionary)];
+    int status = check_letters(letters, stderr);
+    if (status) {
+        exit(status);
+    }
+    // If everything is right, return
+    return letters;
+}
+
+/* Gets the "dictionary" arguments and stores how many there are in count
+ */
+char** get_arg_dictionaries(int argc, char** argv, int* count) {
+    static char* fallback = "/usr/share/dict/words";
+    *count = get_arg_has_dictionary(argc, argv);
+    if (*count) {
+        return argv + argc - *count;
     } else {
-        return fallback;
+        *count = 1;
+        return &fallback;
     }
 }
 
@@ -118,6 +149,26 @@ int get_mode(int argc, char** argv) {
             } else if (!strcmp(argv[i], "-longest") && !argSet) {
                 argSet++;
                 returnCode = 3;
+            } else if (!strcmp(argv[i], "-threads") ||
+                    !strcmp(argv[i], "-top") ||
+                    !strcmp(argv[i], "-cachesize")) {
+                // Next argument must be a thread count from 1 to MAXTHREADS
+                // or a word count (or cache size in KiB) from 1 to INT_MAX
+                char* end;
+                long number = i + 1 < argc ?
+                        strtol(argv[i + 1], &end, 10) : 0;
+                long most = !strcmp(argv[i], "-threads") ? MAXTHREADS :
+                        INT_MAX;
+                if (number < 1 || number > most || *end != '\0') {
+                    returnCode = 0;
+                    break;
+                }
+                i++;
+            } else if (!strcmp(argv[i], "-stream")) {
+                // Only the default mode can print words as they are found
+            } else if (!strcmp(argv[i], "-cache")) {
+                // Plain dictionaries are read through a signature cache and
+                // answers are kept in a results cache
             } else if (!strcmp(argv[i], "-include")) {
                 // If next argument is exactly 1 character long
                 if (argv[i + 1][1] == '\0') {
@@ -133,105 +184,103 @@ int get_mode(int argc, char** argv) {
             }
         } else {
             // There exists some unknown option proceeding -
-            if (!strcmp(argv[i - 1], "-include")) {
+            if (!strcmp(argv[i - 1], "-include") ||
+                    !strcmp(argv[i - 1], "-threads") ||
+                    !strcmp(argv[i - 1], "-top") ||
+                    !strcmp(argv[i - 1], "-cachesize")) {
             } else {
                 endArgs++;
             }
         }
     }
-    // Dictionary optional
-    if (endArgs == 1 || endArgs == 2) {
+    // Streaming can not be ordered, filtered or cut short
+    if (get_arg_flag(argc, argv, "-stream") && (returnCode != 4 ||
+            get_arg_number(argc, argv, "-top", 0))) {
+        return 0;
+    }
+    // Dictionaries optional
+    if (endArgs >= 1 && endArgs <= 1 + MAXDICTIONARIES) {
         return returnCode;
     } else {
         return 0;
     }
 }
 
-/* Creates and returns a FILE pointer iff the file exists, else exit(2)
+/* Fills the options of query (see Query) from the arguments and mode, -top
+ * keeps the first words alphabetically for -alpha, else the longest
+ */
+void get_arg_query_options(int argc, char** argv, int mode, Query* query) {
+    query->longest = mode == 3;
+    query->top = get_arg_number(argc, argv, "-top", 0);
+    query->order = mode == 1 ? string_compare : int_compare;
+    query->stream = get_arg_flag(argc, argv, "-stream") ? stdout : NULL;
+}
+
+/* Maps the dictionary read-only and returns its text iff the file exists,
+ * else exit(2)
  */
-FILE* init_dictionary(char* argDictionary) {
-    FILE* reader = fopen(argDictionary, "r");
-    if (reader == NULL) {
+char* init_dictionary(char* argDictionary, size_t* size) {
+    char* text = map_file(argDictionary, size);
+    if (text == NULL) {
         fprintf(stderr, "unjumble: file \"%s\" can not be opened\n", 
                 argDictionary);
         exit(2);
     }
-    return reader;
+    return text;
 }
 
-/* Returns an int array of the number of occurrences of letters "a" to "z"
- * in given word
+/* Returns 1 if a line read from a dictionary is alphabetical and long
+ * enough to be unjumbled, 0 otherwise
  */
-int* count_letters(char* letters) {
-    int* count = calloc(ALPHASIZE, sizeof(int));
-    for (int i = 0; i < strlen(letters); i++) {
-        if (isalpha(letters[i])) {
-            count[tolower(letters[i]) - 'a']++;
+int word_is_valid(char* word, int length) {
+    for (int i = 0; i < length; i++) {
+        if (letter_of(word[i]) < 0 && word[i] != '\n') {
+            return 0;
         }
     }
-    return count;
+    return length >= 4;
 }
 
 /* Returns the matched words in lexicographical order (as per dictionary) 
  * this serves as a base function from which other functions may extend.
+ * Matched words are views into the mapped dictionary, nothing is copied.
  */
 StringArray* unjumble_default(int argc, char** argv) {
-    StringArray* a = malloc(sizeof(StringArray)); // Init StringArray
-    FILE* dictionary = init_dictionary(get_arg_dictionary(argc, argv));
     char* letters = get_arg_letters(argc, argv); // Get [letters] from argv
-    int* lettersBreakdown = count_letters(letters); // Generate letters sig
-    int* wordBreakdown; // Empty int* for dictionary word signature
-    char includeLetter = get_arg_include_letter(argc, argv); // -include letter
-    int* letterBreakdown = malloc(sizeof(char) * ALPHASIZE);
-    if (includeLetter != '\0') {
-        char* includeLetterItems = malloc(sizeof(char));
-        includeLetterItems[0] = includeLetter;
-        letterBreakdown = count_letters(includeLetterItems); 
-    }
-    char bufferWord[MAXWORDLEN]; // Initializes buffer for word from dictionary
-    a->words = malloc(0); // Allocates memory for empty StringArray.words
-    a->size = 0; // Sets empty StringArray.size to 0
-    while (fgets(bufferWord, MAXWORDLEN, dictionary) != NULL) {
-        int nonMatch = 0; // Match if not 0
-        int wordLength = 0; 
-        for (int i = 0; i < strlen(bufferWord); i++) {
-            if (!isalpha(bufferWord[i]) && bufferWord[i] != '\n') {
-                nonMatch++;
-            }
-            wordLength++;
-        } 
-        if (wordLength < 4) {
-            nonMatch++;
-        } 
-        if (!nonMatch) {
-            wordBreakdown = count_letters(bufferWord); // Generate sig for dict
-            for (int i = 0; i < ALPHASIZE; i++) {
-                if (wordBreakdown[i] > lettersBreakdown[i]) {
-                    nonMatch++;
-                } 
-                if (includeLetter != '\0') { // Filter no letter in dict word
-                    if (wordBreakdown[i] < letterBreakdown[i]) {
-                        nonMatch++;
-                    }
-                }
-            }
-            if (!nonMatch) { // If word can be created from letters
-                a->words = realloc(a->words, sizeof(char*) * (a->size + 1));
-                a->words[a->size] = strdup(bufferWord);
-                a->size++;
-            }
-        }
-    }
-    free(letterBreakdown);
-    return a;
+    int threads = get_arg_number(argc, argv, "-threads", 1);
+    int count;
+    char** dictionaries = get_arg_dictionaries(argc, argv, &count);
+    Dictionary* dictionary = dictionary_federate(dictionaries, count,
+            threads, get_arg_flag(argc, argv, "-cache"));
+    Query query;
+    query_compute(letters, get_arg_include_letter(argc, argv),
+            arena_create(), &query);
+    get_arg_query_options(argc, argv, get_mode(argc, argv), &query);
+    return unjumble_dictionary(dictionary, &query, threads);
 }
 
-/* Takes char pointer and returns alphabetical difference between them
+/* Takes Word pointers and returns alphabetical difference between them,
+ * words that only differ in case keep dictionary order
  */
 int string_compare(const void* p1, const void* p2) {
-    char* string1 = *(char**)p1;
-    char* string2 = *(char**)p2;
-    return strcasecmp(string1, string2);
+    const Word* word1 = p1;
+    const Word* word2 = p2;
+    if (word1->key != word2->key) {
+        return word1->key < word2->key ? -1 : 1;
+    }
+    int shorter = word1->length < word2->length ? word1->length :
+            word2->length;
+    for (int i = 8; i < shorter; i++) { // Keys hold the first 8
+        int difference = letter_fold(word1->text[i]) -
+                letter_fold(word2->text[i]);
+        if (difference) {
+            return difference;
+        }
+    }
+    if (word1->length != word2->length) {
+        return word1->length - word2->length;
+    }
+    return (word1->text > word2->text) - (word1->text < word2->text);
 }
 
 /* Quicksort function for -alpha
@@ -241,16 +290,20 @@ StringArray* qsort_alphabetical(StringArray* a) {
     return a;
 }
 
-/* Takes char pointers and returns the difference in length between them
+/* Takes Word pointers and returns the difference in length between them,
+ * words of the same length are in alphabetical order
  */
 int int_compare(const void* p1, const void* p2) {
-    char* string1 = *(char**)p1;
-    char* string2 = *(char**)p2;
+    const Word* word1 = p1;
+    const Word* word2 = p2;
 
-    return (strlen(string2) - strlen(string1));
+    if (word1->length != word2->length) {
+        return (word2->length - word1->length);
+    }
+    return string_compare(p1, p2);
 }
 
-/* Quicksort function for -len
+/* Quicksort function for -len, a single sort by length then alphabetically
  */
 StringArray* qsort_length(StringArray* a) {
     qsort(a->words, a->size, sizeof(a->words[0]), int_compare);
@@ -278,25 +331,17 @@ StringArray* removeString(StringArray* a, int indexRemove) {
  */
 StringArray* filter_longest(StringArray* a) {
     int currentLongest = 0;
-    int currentLength = 0;
-    char** newWords = malloc(0);
     int newSize = 0;
     for (int i = 0; i < a->size; i++) {
-        currentLength = strlen(a->words[i]);      
-        if (currentLength > currentLongest) {
-            currentLongest = currentLength;
+        if (a->words[i].length > currentLongest) {
+            currentLongest = a->words[i].length;
         }
     }
-    for (int i = 0; i < a->size; i++) {
-        currentLength = strlen(a->words[i]);
-        if (currentLength >= currentLongest) {
-            newWords = realloc(newWords, sizeof(char*) * (newSize + 1));
-            newWords[newSize] = malloc(sizeof(char) * MAXWORDLEN);
-            strcpy(newWords[newSize], a->words[i]);
-            newSize++;
+    for (int i = 0; i < a->size; i++) { // Views are kept in place
+        if (a->words[i].length >= currentLongest) {
+            a->words[newSize++] = a->words[i];
         }
     }
-    a->words = newWords;
     a->size = newSize;
     return a;
 }
@@ -307,41 +352,200 @@ StringArray* filter_longest(StringArray* a) {
 StringArray* unjumble(int argc, char** argv) {
     // Gets the mode the user has selected
     int mode = get_mode(argc, argv);
-     
-    StringArray* a;
 
-    if (mode == 4) {
-        a = unjumble_default(argc, argv);
-    } else if (mode == 1) {
-        a = qsort_alphabetical(unjumble_default(argc, argv));
-    } else if (mode == 2) {
-        a = qsort_length(qsort_alphabetical(unjumble_default(argc, argv)));
-    } else if (mode == 3) {
-        a = filter_longest(unjumble_default(argc, argv));
+    return unjumble_mode(mode, get_arg_number(argc, argv, "-top", 0),
+            unjumble_default(argc, argv));
+}
+
+/* Orders or filters the matched words a as per mode (see get_mode) then
+ * keeps only the first top of them if top is not 0
+ */
+StringArray* unjumble_mode(int mode, int top, StringArray* a) {
+    if (mode == 3) {
+        a = filter_longest(a);
+    }
+    if (mode == 1) {
+        a = qsort_alphabetical(a);
+    } else if (mode == 2 || top) { // -top is by length unless -alpha
+        a = qsort_length(a);
+    }
+    if (top && a->size > top) {
+        a->size = top;
     }
     return a;
 }
 
+/* Prints every word of a to stream, in order
+ */
+void print_words(StringArray* a, FILE* stream) {
+    for (int i = 0; i < a->size; i++) { 
+        fwrite(a->words[i].text, 1, a->words[i].length, stream);
+    }
+}
+
+/* Opens the results cache next to argDictionary if -cache was given, with
+ * the -cachesize limit. Returns NULL if there is none, streamed answers
+ * are never cached.
+ */
+ResultCache* get_arg_result_cache(int argc, char** argv,
+        char* argDictionary) {
+    if (!get_arg_flag(argc, argv, "-cache") ||
+            get_arg_flag(argc, argv, "-stream")) {
+        return NULL;
+    }
+    return result_cache_open(argDictionary, (size_t)get_arg_number(argc,
+            argv, "-cachesize", RESULTCACHEKB) * 1024);
+}
+
+/* Answers a query from the results cache (-cache) if it was asked before,
+ * without loading any dictionary, else unjumbles it and caches the answer.
+ * Returns the exit status.
+ */
+int unjumble_cached(int argc, char** argv, ResultCache* cache) {
+    int count;
+    char** dictionaries = get_arg_dictionaries(argc, argv, &count);
+    uint64_t id = result_cache_id(dictionaries, count);
+    char key[RESULTKEYSIZE];
+    int keyLength = result_cache_key(get_arg_letters(argc, argv),
+            get_arg_include_letter(argc, argv), get_mode(argc, argv),
+            get_arg_number(argc, argv, "-top", 0), key);
+    ResultEntry* entry = keyLength < 0 ? NULL :
+            result_cache_get(cache, id, key, keyLength);
+    int status;
+    if (entry != NULL) {
+        fwrite(entry->data + entry->keyLength, 1, entry->valueLength,
+                stdout);
+        status = entry->valueLength ? 0 : 10;
+    } else {
+        StringArray* a = unjumble(argc, argv);
+        if (keyLength >= 0) {
+            result_cache_put(cache, id, key, keyLength, a);
+        }
+        print_words(a, stdout);
+        status = a->size ? 0 : 10;
+    }
+    result_cache_close(cache);
+    return status;
+}
+
+/* Loads the dictionaries (last arguments) once then unjumbles every line of
+ * stdin as a set of letters, options apply to every query. The words of
+ * each query are followed by an empty line, invalid letters print their
+ * error instead of words. Returns exit status 1 on bad arguments, else 0.
+ */
+int unjumble_batch(int argc, char** argv) {
+    // Options are checked as if "-batch" was the program name
+    int mode = get_mode(argc - 1, argv + 1);
+    // Every argument after the options is a dictionary
+    int count = get_arg_has_dictionary(argc - 1, argv + 1) + 1;
+    if (argc < 3 || !mode || argv[argc - 1][0] == '-' ||
+            count > MAXDICTIONARIES) {
+        fprintf(stderr, "Usage: unjumble -batch [-alpha|-len|-longest]"
+                " [-include letter] [-threads n] [-top k] [-stream]"
+                " [-cache] [-cachesize kb] dictionary...\n");
+        return 1;
+    }
+    int threads = get_arg_number(argc, argv, "-threads", 1);
+    int top = get_arg_number(argc, argv, "-top", 0);
+    char includeLetter = get_arg_include_letter(argc, argv);
+    Dictionary* dictionary = dictionary_federate(argv + argc - count, count,
+            threads, get_arg_flag(argc, argv, "-cache"));
+    ResultCache* cache = get_arg_result_cache(argc, argv,
+            argv[argc - count]);
+    uint64_t id = result_cache_id(argv + argc - count, count);
+    anagram_build(dictionary);
+    trie_build(dictionary);
+    Arena* arena = arena_create();
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, stdin)) >= 0) {
+        if (length > 0 && line[length - 1] == '\n') {
+            line[length - 1] = '\0';
+        }
+        if (!check_letters(line, stderr)) {
+            char key[RESULTKEYSIZE];
+            int keyLength = cache == NULL ? -1 :
+                    result_cache_key(line, includeLetter, mode, top, key);
+            ResultEntry* entry = keyLength < 0 ? NULL :
+                    result_cache_get(cache, id, key, keyLength);
+            if (entry != NULL) {
+                fwrite(entry->data + entry->keyLength, 1,
+                        entry->valueLength, stdout);
+            } else {
+                Query query;
+                query_compute(line, includeLetter, arena, &query);
+                get_arg_query_options(argc, argv, mode, &query);
+                StringArray* a = unjumble_mode(mode, top,
+                        unjumble_dictionary(dictionary, &query, threads));
+                if (!query.stream) {
+                    print_words(a, stdout);
+                }
+                if (keyLength >= 0) {
+                    result_cache_put(cache, id, key, keyLength, a);
+                }
+                arena_reset(arena);
+            }
+        }
+        printf("\n");
+    }
+    free(line);
+    arena_destroy(arena);
+    if (cache != NULL) {
+        result_cache_close(cache);
+    }
+    return 0;
+}
+
 /* This is the main function, it's automagically executed each time this
  * program is run.
  */
 int main(int argc, char** argv) {
+    // Builds an index of a dictionary instead of unjumbling
+    if (argc == 4 && !strcmp(argv[1], "-build-index")) {
+        build_index(argv[2], argv[3]);
+        return 0;
+    }
+    // Reports how well the results cache of a dictionary is doing
+    if (argc == 3 && !strcmp(argv[1], "-cache-stats")) {
+        result_cache_stats(argv[2]);
+        return 0;
+    }
+    // Keeps the dictionary resident and answers queries over a socket
+    if (argc > 1 && !strcmp(argv[1], "-serve")) {
+        return unjumble_serve(argc, argv);
+    }
+    // Answers many queries against one dictionary
+    if (argc > 1 && !strcmp(argv[1], "-batch")) {
+        return unjumble_batch(argc, argv);
+    }
     // Checks arguments inputted by the user
     if (!get_mode(argc, argv) || !get_arg_letters(argc, argv)) {
         // The argument check has failed
         fprintf(stderr, "Usage: unjumble [-alpha|-len|-longest]"
-                " [-include letter] letters [dictionary]\n");
+                " [-include letter] [-threads n] [-top k] [-stream]"
+                " [-cache] [-cachesize kb] letters [dictionary...]\n");
         exit(1);
     } else {
         // The argument check has passed
+        if (get_arg_flag(argc, argv, "-stream")) {
+            setvbuf(stdout, NULL, _IOFBF, STREAMBUFFER);
+        }
+        int count;
+        ResultCache* cache = get_arg_result_cache(argc, argv,
+                get_arg_dictionaries(argc, argv, &count)[0]);
+        if (cache != NULL) {
+            return unjumble_cached(argc, argv, cache);
+        }
         StringArray* a = unjumble(argc, argv);
         // If there exists no element in the set of a->words, 
         // exit with status 10
         if (a->size < 1) {
             exit(10);
         }
-        for (int i = 0; i < a->size; i++) { 
-            printf("%s", a->words[i]);
+        // Words were already printed if streamed
+        if (!get_arg_flag(argc, argv, "-stream")) {
+            print_words(a, stdout);
         }
     }
     return 0;
@@ -7,16 +7,24 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #define PORT_MAX 65536
 #define PORT_MIN 0
 #define SIZE_BUFFER 4096
+#define POOL_DEFAULT_THREADS 16
+#define POOL_QUEUE_FACTOR 2
+#define POOL_CLIENT_TIMEOUT 30
+#define EXPRESSION_CACHE_SIZE 64
+#define PROGRAM_BLOCK 256
 
 /*
  * This struct stores a list of strings and size of said list
@@ -51,6 +59,137 @@ typedef struct JobArray {
     Job** jobs;
 } JobArray;
 
+/*
+ * This struct stores the share of an integration job done by one thread,
+ * points first to last - 1 of the job, and the weighted sum it found
+ */
+typedef struct Slice {
+    Job* job;
+    int first;
+    int last;
+    double sum;
+} Slice;
+
+/*
+ * This struct stores the slices of one integration job while they are
+ * shared out to the integration pool, the next one nobody has taken yet and
+ * how many are finished. Batches with slices left form a queue.
+ */
+typedef struct SliceBatch {
+    Slice* slices;
+    int count;
+    int next;
+    int done;
+    pthread_cond_t finished;
+    struct SliceBatch* later;
+} SliceBatch;
+
+/*
+ * This struct stores the server-wide pool of integration threads, one per
+ * online CPU, and the queue of batches they take slices from
+ */
+typedef struct IntegrationPool {
+    pthread_mutex_t lock;
+    pthread_cond_t waiting;
+    int threads;
+    SliceBatch* first;
+    SliceBatch* last;
+} IntegrationPool;
+
+/*
+ * This struct stores a bounded queue of accepted client connections waiting
+ * for a worker thread, along with counters describing how deep it gets
+ */
+typedef struct ConnectionQueue {
+    int* clientfds;
+    int capacity;
+    int head;
+    int depth;
+    int peakDepth;
+    unsigned long accepted;
+    unsigned long stalls;
+    pthread_mutex_t lock;
+    sem_t slots;
+    sem_t items;
+} ConnectionQueue;
+
+/*
+ * Operations of a lowered function, see program_run()
+ */
+typedef enum Operation {
+    OP_CONST,
+    OP_X,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_NEG,
+    OP_SQRT,
+    OP_ABS,
+    OP_CALL1,
+    OP_CALL2
+} Operation;
+
+/*
+ * This struct stores one instruction of a lowered function. It fills the
+ * register with its own index from registers a and b, the constant value
+ * or a call to function.
+ */
+typedef struct Instruction {
+    Operation op;
+    int a;
+    int b;
+    double value;
+    const void* function;
+} Instruction;
+
+/*
+ * This struct stores a function lowered to a flat list of instructions,
+ * each working on a block of PROGRAM_BLOCK values of x at once. The last
+ * instruction gives the value of the function.
+ */
+typedef struct Program {
+    int size;
+    Instruction* code;
+} Program;
+
+/*
+ * This struct stores a program compiled to machine code, a function
+ * filling ys with its values at count values of x in xs. It is shared by
+ * every thread using it until the last releases it.
+ */
+typedef struct Native {
+    void (*function)(const double* xs, double* ys, long count);
+    void* code;
+    size_t size;
+    int users;
+} Native;
+
+/*
+ * This struct stores a compiled function in the expression cache, linked
+ * into a list from the most to the least recently used
+ */
+typedef struct CachedExpression {
+    char* function;
+    struct te_expr* expr;
+    Program* program;
+    Native* native;
+    struct CachedExpression* newer;
+    struct CachedExpression* older;
+} CachedExpression;
+
+/*
+ * This struct stores the compiled functions shared by every connection, at
+ * most EXPRESSION_CACHE_SIZE of them, and the variable they are bound to
+ */
+typedef struct ExpressionCache {
+    pthread_mutex_t lock;
+    int count;
+    double x;
+    CachedExpression* newest;
+    CachedExpression* oldest;
+} ExpressionCache;
+
 // Function prototypes from intclient.c
 
 // End function prototypes from intclient.c
@@ -68,4 +207,26 @@ struct sockaddr* socket_getaddrinfo(char* port);
 
 // End function prototypes from intserver.c
 
+// Function prototypes from intjit.c
+
+/*
+ *  Compiles a program to x86-64 machine code evaluating it at many x
+ *  Params:
+ *      const Program* program - the program to compile
+ *  Returns (Native*):
+ *      native - the compiled function, users is 1
+ *      NULL - no JIT for this machine or the memory could not be mapped
+ */
+Native* jit_compile(const Program* program);
+
+/*
+ *  Frees a compiled function and unmaps its machine code
+ *  Params:
+ *      Native* native - the compiled function
+ *  Returns (void):
+ */
+void jit_free(Native* native);
+
+// End function prototypes from intjit.c
+
 #endif
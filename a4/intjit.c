@@ -0,0 +1,368 @@
+#include "intcommon.h"
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#define JIT_PROLOGUE_SIZE 128
+#define JIT_INSTRUCTION_SIZE 64
+#define JIT_FIRST_XMM 2
+#define JIT_LAST_XMM 15
+#define JIT_UNREAD -2
+
+/*
+ * This struct stores the machine code of a program while it is written,
+ * where each register of the program lives (an xmm register, -1 for the
+ * stack or JIT_UNREAD for a constant nothing reads) and which register
+ * xmm0 still holds (-1 for none)
+ */
+typedef struct Jit {
+    unsigned char* code;
+    size_t length;
+    int* homes;
+    int cached;
+} Jit;
+
+/*
+ *  Appends bytes of machine code
+ *  Params:
+ *      Jit* jit - code being written
+ *      const unsigned char* bytes - the machine code
+ *      int count - number of bytes
+ *  Returns (void):
+ */
+void jit_bytes(Jit* jit, const unsigned char* bytes, int count) {
+    memcpy(jit->code + jit->length, bytes, count);
+    jit->length += count;
+}
+
+/*
+ *  Appends an SSE instruction with xmm register reg as its first operand.
+ *  The second is xmm register rm, or [rbp + displacement] if given.
+ *  Params:
+ *      Jit* jit - code being written
+ *      int prefix - 0xf2 for scalar double instructions, 0x66 for packed
+ *      int opcode - the byte after 0x0f
+ *      int reg - xmm register
+ *      int rm - xmm register, ignored if displacement is given
+ *      int32_t* displacement - offset from rbp, NULL for a register
+ *  Returns (void):
+ */
+void jit_sse(Jit* jit, int prefix, int opcode, int reg, int rm,
+        int32_t* displacement) {
+    int rex = 0x40 | (reg >> 3) << 2 | (displacement ? 0 : rm >> 3);
+    jit_bytes(jit, (unsigned char[]){prefix}, 1);
+    if (rex != 0x40) {
+        jit_bytes(jit, (unsigned char[]){rex}, 1);
+    }
+    if (displacement) {
+        jit_bytes(jit, (unsigned char[]){0x0f, opcode, 0x85 | (reg & 7) << 3},
+                3);
+        jit_bytes(jit, (unsigned char*)displacement, sizeof(int32_t));
+    } else {
+        jit_bytes(jit, (unsigned char[]){0x0f, opcode,
+                0xc0 | (reg & 7) << 3 | (rm & 7)}, 3);
+    }
+}
+
+/*
+ *  Appends an SSE instruction between xmm register reg and register r of
+ *  the program, wherever it is
+ *  Params:
+ *      Jit* jit - code being written
+ *      int prefix - 0xf2 for scalar double instructions, 0x66 for packed
+ *      int opcode - the byte after 0x0f
+ *      int reg - xmm register
+ *      int r - register of the program
+ *  Returns (void):
+ */
+void jit_operand(Jit* jit, int prefix, int opcode, int reg, int r) {
+    if (jit->cached == r) {
+        jit_sse(jit, prefix, opcode, reg, 0, NULL);
+    } else if (jit->homes[r] >= 0) {
+        jit_sse(jit, prefix, opcode, reg, jit->homes[r], NULL);
+    } else { // Below rbp and the four registers pushed after it
+        int32_t displacement = -32 - 8 * (r + 1);
+        jit_sse(jit, prefix, opcode, reg, 0, &displacement);
+    }
+}
+
+/*
+ *  Appends the code loading register r of the program into xmm register
+ *  reg, unless it is already there
+ *  Params:
+ *      Jit* jit - code being written
+ *      int reg - xmm register, 0 or 1
+ *      int r - register of the program
+ *  Returns (void):
+ */
+void jit_load(Jit* jit, int reg, int r) {
+    if (jit->cached == r && reg == 0) {
+        return;
+    }
+    jit_operand(jit, 0xf2, 0x10, reg, r); // movsd
+    if (reg == 0) {
+        jit->cached = r;
+    }
+}
+
+/*
+ *  Appends the code storing xmm0 into register r of the program
+ *  Params:
+ *      Jit* jit - code being written
+ *      int r - register of the program
+ *  Returns (void):
+ */
+void jit_store(Jit* jit, int r) {
+    if (jit->homes[r] >= 0) {
+        jit_sse(jit, 0x66, 0x28, jit->homes[r], 0, NULL); // movapd
+    } else {
+        int32_t displacement = -32 - 8 * (r + 1);
+        jit_sse(jit, 0xf2, 0x11, 0, 0, &displacement); // movsd
+    }
+    jit->cached = r;
+}
+
+/*
+ *  Appends mov rax, value then movq into xmm register reg from rax
+ *  Params:
+ *      Jit* jit - code being written
+ *      int reg - xmm register, 0 or 1
+ *      uint64_t value - the 64 bit value
+ *  Returns (void):
+ */
+void jit_immediate(Jit* jit, int reg, uint64_t value) {
+    jit_bytes(jit, (unsigned char[]){0x48, 0xb8}, 2);
+    jit_bytes(jit, (unsigned char*)&value, sizeof(value));
+    jit_bytes(jit, (unsigned char[]){0x66, 0x48, 0x0f, 0x6e, 0xc0 | reg << 3},
+            5);
+}
+
+/*
+ *  Returns whether an instruction reads its register b
+ *  Params:
+ *      const Instruction* instruction - the instruction
+ *  Returns (int):
+ *      1 - it reads b
+ *      0 - it does not
+ */
+int jit_reads_b(const Instruction* instruction) {
+    switch (instruction->op) {
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_CALL2:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+ *  Appends the code computing one instruction into xmm0. The value of x is
+ *  at [rbx + r14 * 8].
+ *  Params:
+ *      Jit* jit - code being written
+ *      const Instruction* instruction - the instruction
+ *  Returns (void):
+ */
+void jit_instruction(Jit* jit, const Instruction* instruction) {
+    static const int arithmetic[] = {[OP_ADD] = 0x58, [OP_SUB] = 0x5c,
+            [OP_MUL] = 0x59, [OP_DIV] = 0x5e};
+    uint64_t bits;
+    switch (instruction->op) {
+        case OP_CONST:
+            memcpy(&bits, &instruction->value, sizeof(bits));
+            jit_immediate(jit, 0, bits);
+            break;
+        case OP_X: // movsd xmm0, [rbx + r14 * 8]
+            jit_bytes(jit, (unsigned char[]){0xf2, 0x42, 0x0f, 0x10, 0x04,
+                    0xf3}, 6);
+            break;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+            if (instruction->b == jit->cached &&
+                    instruction->a != jit->cached) {
+                jit_load(jit, 1, instruction->b); // Keep b, load a over it
+                jit_load(jit, 0, instruction->a);
+                jit_sse(jit, 0xf2, arithmetic[instruction->op], 0, 1, NULL);
+            } else {
+                jit_load(jit, 0, instruction->a);
+                jit_operand(jit, 0xf2, arithmetic[instruction->op], 0,
+                        instruction->b);
+            }
+            break;
+        case OP_NEG:
+        case OP_ABS:
+            jit_load(jit, 0, instruction->a);
+            jit_immediate(jit, 1, instruction->op == OP_NEG ?
+                    0x8000000000000000ull : 0x7fffffffffffffffull);
+            jit_sse(jit, 0x66, instruction->op == OP_NEG ? 0x57 : 0x54, 0, 1,
+                    NULL); // xorpd or andpd
+            break;
+        case OP_SQRT:
+            jit_operand(jit, 0xf2, 0x51, 0, instruction->a);
+            break;
+        case OP_CALL1:
+        case OP_CALL2:
+            if (instruction->op == OP_CALL2) {
+                jit_load(jit, 1, instruction->b);
+            }
+            jit_load(jit, 0, instruction->a);
+            bits = (uintptr_t)instruction->function;
+            jit_bytes(jit, (unsigned char[]){0x48, 0xb8}, 2);
+            jit_bytes(jit, (unsigned char*)&bits, sizeof(bits));
+            jit_bytes(jit, (unsigned char[]){0xff, 0xd0}, 2); // call rax
+            break;
+    }
+}
+
+/*
+ *  Decides where each register of a program lives. Calls clobber every xmm
+ *  register, so in programs with calls they all live on the stack. In
+ *  those without, registers get one of xmm2 to xmm15 from when they are
+ *  set until they are last read, and only the rest go on the stack.
+ *  Constants nothing reads live nowhere and are never set.
+ *  Params:
+ *      const Program* program - the program
+ *      int* homes - set to an xmm register, -1 or JIT_UNREAD for each
+ *              register
+ *  Returns (void):
+ */
+void jit_allocate(const Program* program, int* homes) {
+    int* lastRead = malloc(sizeof(int) * program->size);
+    int calls = 0;
+    for (int r = 0; r < program->size; r++) {
+        const Instruction* instruction = &program->code[r];
+        homes[r] = -1;
+        lastRead[r] = r;
+        if (instruction->op != OP_CONST && instruction->op != OP_X) {
+            lastRead[instruction->a] = r;
+        }
+        if (jit_reads_b(instruction)) {
+            lastRead[instruction->b] = r;
+        }
+        calls |= instruction->op == OP_CALL1 || instruction->op == OP_CALL2;
+    }
+    for (int r = 0; r < program->size; r++) {
+        if (program->code[r].op != OP_CONST) {
+            continue;
+        } else if (lastRead[r] == r && r < program->size - 1) {
+            homes[r] = JIT_UNREAD;
+        } else { // Set once before the loop
+            lastRead[r] = program->size;
+        }
+    }
+    int owners[JIT_LAST_XMM + 1];
+    for (int xmm = JIT_FIRST_XMM; xmm <= JIT_LAST_XMM; xmm++) {
+        owners[xmm] = -1;
+    }
+    // Constants first, they are set before any other register
+    for (int pass = 0; pass < 2 && !calls; pass++) {
+        for (int r = 0; r < program->size; r++) {
+            if ((program->code[r].op == OP_CONST) != (pass == 0) ||
+                    homes[r] == JIT_UNREAD) {
+                continue;
+            }
+            for (int xmm = JIT_FIRST_XMM; xmm <= JIT_LAST_XMM; xmm++) {
+                // Free once read for the last time, r is set after reading
+                if (owners[xmm] < 0 || lastRead[owners[xmm]] <= r) {
+                    owners[xmm] = r;
+                    homes[r] = xmm;
+                    break;
+                }
+            }
+        }
+    }
+    free(lastRead);
+}
+
+/*
+ *  Compiles a program to x86-64 machine code for a function filling ys[i]
+ *  with the value of the program at xs[i] for count values of x. The
+ *  constants of the program are set up once before the loop over x. It
+ *  makes the same calls and correctly rounded SSE arithmetic as te_eval(),
+ *  so it gives the same values bit for bit. The code is written into a
+ *  memory mapping which is then made executable.
+ *  Params:
+ *      const Program* program - the program to compile
+ *  Returns (Native*):
+ *      native - the compiled function, users is 1
+ *      NULL - no JIT for this machine or the memory could not be mapped
+ */
+Native* jit_compile(const Program* program) {
+#if defined(__x86_64__) && !defined(NO_JIT)
+    size_t size = JIT_PROLOGUE_SIZE + JIT_INSTRUCTION_SIZE * program->size;
+    void* code = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        return NULL;
+    }
+    Jit jit = {code, 0, malloc(sizeof(int) * program->size), -1};
+    jit_allocate(program, jit.homes);
+    int32_t frame = (8 * program->size + 15) & ~15; // Keep calls aligned
+    // push rbp; mov rbp, rsp; push rbx; push r12; push r13; push r14
+    jit_bytes(&jit, (unsigned char[]){0x55, 0x48, 0x89, 0xe5, 0x53, 0x41,
+            0x54, 0x41, 0x55, 0x41, 0x56}, 11);
+    jit_bytes(&jit, (unsigned char[]){0x48, 0x81, 0xec}, 3); // sub rsp
+    jit_bytes(&jit, (unsigned char*)&frame, sizeof(frame));
+    // mov rbx, rdi (xs); mov r12, rsi (ys); mov r13, rdx (count); r14 = 0
+    jit_bytes(&jit, (unsigned char[]){0x48, 0x89, 0xfb, 0x49, 0x89, 0xf4,
+            0x49, 0x89, 0xd5, 0x45, 0x31, 0xf6}, 12);
+    for (int r = 0; r < program->size; r++) {
+        if (program->code[r].op == OP_CONST && jit.homes[r] != JIT_UNREAD) {
+            jit_instruction(&jit, &program->code[r]);
+            jit_store(&jit, r);
+        }
+    }
+    // test r13, r13; jle done
+    jit_bytes(&jit, (unsigned char[]){0x4d, 0x85, 0xed, 0x0f, 0x8e}, 5);
+    size_t skip = jit.length;
+    jit_bytes(&jit, (unsigned char[]){0, 0, 0, 0}, 4);
+    size_t loop = jit.length;
+    jit.cached = -1; // Unknown each time round the loop
+    for (int r = 0; r < program->size; r++) {
+        if (program->code[r].op != OP_CONST) {
+            jit_instruction(&jit, &program->code[r]);
+            jit_store(&jit, r);
+        }
+    }
+    jit_load(&jit, 0, program->size - 1);
+    // movsd [r12 + r14 * 8], xmm0; inc r14; cmp r14, r13; jl loop
+    jit_bytes(&jit, (unsigned char[]){0xf2, 0x43, 0x0f, 0x11, 0x04, 0xf4,
+            0x49, 0xff, 0xc6, 0x4d, 0x39, 0xee, 0x0f, 0x8c}, 14);
+    int32_t back = loop - (jit.length + 4);
+    jit_bytes(&jit, (unsigned char*)&back, sizeof(back));
+    int32_t forward = jit.length - (skip + 4); // done:
+    memcpy(jit.code + skip, &forward, sizeof(forward));
+    // lea rsp, [rbp - 32]; pop r14; pop r13; pop r12; pop rbx; pop rbp; ret
+    jit_bytes(&jit, (unsigned char[]){0x48, 0x8d, 0x65, 0xe0, 0x41, 0x5e,
+            0x41, 0x5d, 0x41, 0x5c, 0x5b, 0x5d, 0xc3}, 13);
+    free(jit.homes);
+    if (mprotect(code, size, PROT_READ | PROT_EXEC)) {
+        munmap(code, size);
+        return NULL;
+    }
+    Native* native = malloc(sizeof(Native));
+    native->code = code;
+    native->size = size;
+    native->users = 1;
+    memcpy(&native->function, &code, sizeof(code));
+    return native;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ *  Frees a compiled function and unmaps its machine code
+ *  Params:
+ *      Native* native - the compiled function
+ *  Returns (void):
+ */
+void jit_free(Native* native) {
+    munmap(native->code, native->size);
+    free(native);
+}
@@ -1,10 +1,33 @@
 #include "intcommon.h"
 
+#include <math.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <semaphore.h>
 #include <pthread.h>
+#include <stddef.h>
 #include <tinyexpr.h>
 
+#define EXPRESSION_TYPE(type) ((type) & 0x1f)
+#define EXPRESSION_ARITY(type) \
+        ((type) & (TE_FUNCTION0 | TE_CLOSURE0) ? (type) & 0x7 : 0)
+#define EXPRESSION_CONSTANT 1 // TE_CONSTANT is private to tinyexpr.c
+
+typedef double (*Function1)(double);
+typedef double (*Function2)(double, double);
+
+// Compiled functions shared by every connection, see expression_cache_get()
+ExpressionCache expressionCache = {PTHREAD_MUTEX_INITIALIZER, 0, 0.0, NULL,
+        NULL};
+
+// Threads integrating slices of every job, see integration_pool_start()
+IntegrationPool integrationPool = {PTHREAD_MUTEX_INITIALIZER,
+        PTHREAD_COND_INITIALIZER, 0, NULL, NULL};
+
+// tinyexpr's operators by Operation, see program_operators()
+const void* programOperators[OP_CALL1];
+pthread_once_t programOperatorsOnce = PTHREAD_ONCE_INIT;
+
 /*
  *  Returns whether the port argument is valid or not
  *  Params:
@@ -31,7 +54,7 @@ int check_arg_port(char* port) {
  *      int argc - size of argv
  *      int argv - user-input arguments
  *  Returns (int):
- *      0 - not specified (unlimited)
+ *      0 - not specified, POOL_DEFAULT_THREADS workers are used
  *      maxThreads - the maximum specified
  */
 int get_arg_maxthreads(int argc, char** argv) {
@@ -145,6 +168,434 @@ bool isprefix(char* prefix, char* string) {
     return strncmp(prefix, string, strlen(prefix)) == 0;
 }
 
+/*
+ *  Copies a compiled function, binding the copy to another x variable
+ *  Params:
+ *      const te_expr* expr - compiled function bound to expressionCache.x
+ *      double* x - the variable the copy reads x from
+ *  Returns (te_expr*):
+ *      clone - the copy, to be freed with te_free()
+ */
+te_expr* expression_clone(const te_expr* expr, double* x) {
+    int arity = EXPRESSION_ARITY(expr->type);
+    int closure = (expr->type & TE_CLOSURE0) != 0;
+    te_expr* clone = malloc(sizeof(te_expr) +
+            sizeof(void*) * (arity + closure));
+    memcpy(clone, expr, offsetof(te_expr, parameters));
+    if (EXPRESSION_TYPE(expr->type) == TE_VARIABLE &&
+            expr->bound == &expressionCache.x) {
+        clone->bound = x;
+    }
+    for (int i = 0; i < arity; i++) {
+        clone->parameters[i] = expression_clone(expr->parameters[i], x);
+    }
+    if (closure) { // Closure context is shared, not owned
+        clone->parameters[arity] = expr->parameters[arity];
+    }
+    return clone;
+}
+
+/*
+ *  Returns the function of one parameter of a compiled function node.
+ *  tinyexpr stores functions as const void*, which ISO C can not cast.
+ *  Params:
+ *      const void* function - function of a compiled function node
+ *  Returns (Function1):
+ *      f - the function
+ */
+Function1 function1_of(const void* function) {
+    Function1 f;
+    memcpy(&f, &function, sizeof(f));
+    return f;
+}
+
+/*
+ *  Returns the function of two parameters of a compiled function node
+ *  Params:
+ *      const void* function - function of a compiled function node
+ *  Returns (Function2):
+ *      f - the function
+ */
+Function2 function2_of(const void* function) {
+    Function2 f;
+    memcpy(&f, &function, sizeof(f));
+    return f;
+}
+
+/*
+ *  Fills programOperators. tinyexpr keeps its operators (add, sub, mul,
+ *  divide and negate) static, so each is taken from the root of a compiled
+ *  expression using it. One that can not be found stays NULL and is only
+ *  ever called.
+ *  Params:
+ *  Returns (void):
+ */
+void program_operators(void) {
+    const char* probes[OP_CALL1] = {[OP_ADD] = "x+x", [OP_SUB] = "x-x",
+            [OP_MUL] = "x*x", [OP_DIV] = "x/x", [OP_NEG] = "-x"};
+    double x;
+    te_variable variables[] = {{"x", &x}};
+    for (int op = 0; op < OP_CALL1; op++) {
+        int errorPosition;
+        te_expr* expr = probes[op] ?
+                te_compile(probes[op], variables, 1, &errorPosition) : NULL;
+        if (expr && expr->type & TE_FUNCTION0) {
+            programOperators[op] = expr->function;
+        }
+        te_free(expr);
+    }
+}
+
+/*
+ *  Returns the operation calling function does, by comparing it with
+ *  tinyexpr's operators and the libm functions lowered inline
+ *  Params:
+ *      const void* function - pure function of a compiled function node
+ *      int arity - 1 or 2, number of parameters of function
+ *  Returns (Operation):
+ *      op - the operation, OP_CALL1 or OP_CALL2 if it is none in particular
+ */
+Operation program_operation(const void* function, int arity) {
+    pthread_once(&programOperatorsOnce, program_operators);
+    if (arity == 1) {
+        Function1 f = function1_of(function);
+        if (f == sqrt) {
+            return OP_SQRT;
+        } else if (f == fabs) {
+            return OP_ABS;
+        } else if (function == programOperators[OP_NEG]) {
+            return OP_NEG;
+        }
+        return OP_CALL1;
+    }
+    Operation ops[] = {OP_ADD, OP_SUB, OP_MUL, OP_DIV};
+    for (int i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (function == programOperators[ops[i]]) {
+            return ops[i];
+        }
+    }
+    return OP_CALL2;
+}
+
+/*
+ *  Appends the instructions computing a compiled function node (and its
+ *  parameters first) to a program
+ *  Params:
+ *      Program* program - program to append to
+ *      const te_expr* expr - compiled function bound to expressionCache.x
+ *  Returns (int):
+ *      register - the register holding the value of the node
+ *      -1 - the node can not be lowered (not pure or too many parameters)
+ */
+int program_lower(Program* program, const te_expr* expr) {
+    Instruction instruction = {OP_CONST, 0, 0, 0.0, NULL};
+    int type = EXPRESSION_TYPE(expr->type);
+    int arity = EXPRESSION_ARITY(expr->type);
+    if (type == TE_VARIABLE) {
+        if (expr->bound != &expressionCache.x) {
+            return -1;
+        }
+        instruction.op = OP_X;
+    } else if (type == EXPRESSION_CONSTANT) {
+        instruction.value = expr->value;
+    } else if (!(expr->type & TE_FLAG_PURE) || expr->type & TE_CLOSURE0 ||
+            arity < 1 || arity > 2) {
+        return -1;
+    } else {
+        instruction.a = program_lower(program, expr->parameters[0]);
+        instruction.b = arity == 2 ?
+                program_lower(program, expr->parameters[1]) : 0;
+        if (instruction.a < 0 || instruction.b < 0) {
+            return -1;
+        }
+        instruction.function = expr->function;
+        instruction.op = program_operation(expr->function, arity);
+    }
+    program->code = realloc(program->code,
+            sizeof(Instruction) * (program->size + 1));
+    program->code[program->size] = instruction;
+    return program->size++;
+}
+
+/*
+ *  Frees a program (if any)
+ *  Params:
+ *      Program* program - the program to free, may be NULL
+ *  Returns (void):
+ */
+void program_free(Program* program) {
+    if (program) {
+        free(program->code);
+        free(program);
+    }
+}
+
+/*
+ *  Lowers a compiled function into a program evaluating blocks of x
+ *  Params:
+ *      const te_expr* expr - compiled function bound to expressionCache.x
+ *  Returns (Program*):
+ *      program - the lowered function
+ *      NULL - the function can not be lowered, te_eval() it instead
+ */
+Program* program_create(const te_expr* expr) {
+    Program* program = malloc(sizeof(Program));
+    program->size = 0;
+    program->code = NULL;
+    if (program_lower(program, expr) < 0) {
+        program_free(program);
+        return NULL;
+    }
+    return program;
+}
+
+/*
+ *  Returns a copy of a program
+ *  Params:
+ *      const Program* program - the program to copy
+ *  Returns (Program*):
+ *      copy - the copy, to be freed with program_free()
+ */
+Program* program_copy(const Program* program) {
+    Program* copy = malloc(sizeof(Program));
+    copy->size = program->size;
+    copy->code = malloc(sizeof(Instruction) * program->size);
+    memcpy(copy->code, program->code, sizeof(Instruction) * program->size);
+    return copy;
+}
+
+/*
+ *  Evaluates a program on a block of values of x, one register (of
+ *  PROGRAM_BLOCK values) per instruction. Each instruction is a plain loop
+ *  over the block which the compiler can vectorise.
+ *  Params:
+ *      const Program* program - the program to run
+ *      double* registers - program->size * PROGRAM_BLOCK values
+ *      const double* xs - the values of x
+ *      int count - number of values of x, at most PROGRAM_BLOCK
+ *  Returns (const double*):
+ *      ys - the values of the function at xs
+ */
+const double* program_run(const Program* program, double* registers,
+        const double* xs, int count) {
+    for (int r = 0; r < program->size; r++) {
+        const Instruction* instruction = &program->code[r];
+        double* out = registers + r * PROGRAM_BLOCK;
+        const double* a = registers + instruction->a * PROGRAM_BLOCK;
+        const double* b = registers + instruction->b * PROGRAM_BLOCK;
+        Function1 f1 = function1_of(instruction->function);
+        Function2 f2 = function2_of(instruction->function);
+        switch (instruction->op) {
+            case OP_CONST:
+                for (int i = 0; i < count; i++) {
+                    out[i] = instruction->value;
+                }
+                break;
+            case OP_X:
+                memcpy(out, xs, sizeof(double) * count);
+                break;
+            case OP_ADD:
+                for (int i = 0; i < count; i++) {
+                    out[i] = a[i] + b[i];
+                }
+                break;
+            case OP_SUB:
+                for (int i = 0; i < count; i++) {
+                    out[i] = a[i] - b[i];
+                }
+                break;
+            case OP_MUL:
+                for (int i = 0; i < count; i++) {
+                    out[i] = a[i] * b[i];
+                }
+                break;
+            case OP_DIV:
+                for (int i = 0; i < count; i++) {
+                    out[i] = a[i] / b[i];
+                }
+                break;
+            case OP_NEG:
+                for (int i = 0; i < count; i++) {
+                    out[i] = -a[i];
+                }
+                break;
+            case OP_SQRT:
+                for (int i = 0; i < count; i++) {
+                    out[i] = sqrt(a[i]);
+                }
+                break;
+            case OP_ABS:
+                for (int i = 0; i < count; i++) {
+                    out[i] = fabs(a[i]);
+                }
+                break;
+            case OP_CALL1:
+                for (int i = 0; i < count; i++) {
+                    out[i] = f1(a[i]);
+                }
+                break;
+            case OP_CALL2:
+                for (int i = 0; i < count; i++) {
+                    out[i] = f2(a[i], b[i]);
+                }
+                break;
+        }
+    }
+    return registers + (program->size - 1) * PROGRAM_BLOCK;
+}
+
+/*
+ *  Unlinks an entry from the recency list of the expression cache. Must
+ *  hold the cache lock.
+ *  Params:
+ *      CachedExpression* entry - an entry of expressionCache
+ *  Returns (void):
+ */
+void expression_unlink(CachedExpression* entry) {
+    if (entry->newer) {
+        entry->newer->older = entry->older;
+    } else {
+        expressionCache.newest = entry->older;
+    }
+    if (entry->older) {
+        entry->older->newer = entry->newer;
+    } else {
+        expressionCache.oldest = entry->newer;
+    }
+}
+
+/*
+ *  Links an entry into the recency list of the expression cache as the most
+ *  recently used. Must hold the cache lock.
+ *  Params:
+ *      CachedExpression* entry - an entry of expressionCache
+ *  Returns (void):
+ */
+void expression_link(CachedExpression* entry) {
+    entry->newer = NULL;
+    entry->older = expressionCache.newest;
+    if (expressionCache.newest) {
+        expressionCache.newest->newer = entry;
+    } else {
+        expressionCache.oldest = entry;
+    }
+    expressionCache.newest = entry;
+}
+
+/*
+ *  Returns the cache entry of a function, NULL if it is not cached. Must
+ *  hold the cache lock.
+ *  Params:
+ *      char* function - i.e. sin(x)
+ *  Returns (CachedExpression*):
+ *      entry - the entry of function
+ */
+CachedExpression* expression_find(char* function) {
+    CachedExpression* entry = expressionCache.newest;
+    while (entry && strcmp(entry->function, function)) {
+        entry = entry->older;
+    }
+    return entry;
+}
+
+/*
+ *  Drops a user of a compiled function, freeing it after the last. Must
+ *  hold the cache lock.
+ *  Params:
+ *      Native* native - the compiled function, may be NULL
+ *  Returns (void):
+ */
+void native_drop(Native* native) {
+    if (native && --native->users == 0) {
+        jit_free(native);
+    }
+}
+
+/*
+ *  Releases a compiled function got from expression_cache_get()
+ *  Params:
+ *      Native* native - the compiled function, may be NULL
+ *  Returns (void):
+ */
+void native_release(Native* native) {
+    pthread_mutex_lock(&expressionCache.lock);
+    native_drop(native);
+    pthread_mutex_unlock(&expressionCache.lock);
+}
+
+/*
+ *  Returns a private copy of a compiled function reading x from the given
+ *  variable, a copy of the function lowered to a program if it could be,
+ *  and the program compiled to machine code if the JIT could. Functions
+ *  are compiled once and shared by every connection through
+ *  expressionCache, which drops the least recently used when it holds more
+ *  than EXPRESSION_CACHE_SIZE.
+ *  Params:
+ *      char* function - i.e. sin(x)
+ *      double* x - the variable the copy reads x from
+ *      Program** program - set to the program (NULL if none), may be NULL
+ *      Native** native - set to the machine code (NULL if none), to be
+ *          released with native_release(), may be NULL
+ *  Returns (te_expr*):
+ *      fx - the compiled function, to be freed with te_free()
+ *      NULL - function is invalid
+ */
+te_expr* expression_cache_get(char* function, double* x, Program** program,
+        Native** native) {
+    pthread_mutex_lock(&expressionCache.lock);
+    CachedExpression* entry = expression_find(function);
+    if (!entry) { // Compile without holding up other connections
+        pthread_mutex_unlock(&expressionCache.lock);
+        te_variable variables[] = {{"x", &expressionCache.x}};
+        int errorPosition;
+        te_expr* expr = te_compile(function, variables, 1, &errorPosition);
+        if (!expr) {
+            return NULL;
+        }
+        Program* lowered = program_create(expr);
+        Native* compiled = lowered ? jit_compile(lowered) : NULL;
+        pthread_mutex_lock(&expressionCache.lock);
+        entry = expression_find(function);
+        if (entry) { // Another connection compiled it meanwhile
+            te_free(expr);
+            program_free(lowered);
+            native_drop(compiled);
+        } else {
+            entry = malloc(sizeof(CachedExpression));
+            entry->function = strdup(function);
+            entry->expr = expr;
+            entry->program = lowered;
+            entry->native = compiled;
+            expression_link(entry);
+            expressionCache.count++;
+        }
+    }
+    expression_unlink(entry);
+    expression_link(entry);
+    te_expr* fx = expression_clone(entry->expr, x);
+    if (program) {
+        *program = entry->program ? program_copy(entry->program) : NULL;
+    }
+    if (native) {
+        *native = entry->native;
+        if (entry->native) {
+            entry->native->users++;
+        }
+    }
+    while (expressionCache.count > EXPRESSION_CACHE_SIZE) {
+        CachedExpression* oldest = expressionCache.oldest;
+        expression_unlink(oldest);
+        te_free(oldest->expr);
+        program_free(oldest->program);
+        native_drop(oldest->native);
+        free(oldest->function);
+        free(oldest);
+        expressionCache.count--;
+    }
+    pthread_mutex_unlock(&expressionCache.lock);
+    return fx;
+}
+
 /*
  *  Determines whether a function is valid or not
  *  Params:
@@ -155,19 +606,173 @@ bool isprefix(char* prefix, char* string) {
  */
 int function_isvalid(char* function) {
     double x;
-    te_variable variables[] = {{"x", &x}};
-    int errorPosition;
-    te_expr* fx = te_compile(function, variables, 1, &errorPosition);
+    te_expr* fx = expression_cache_get(function, &x, NULL, NULL);
     if (!fx) {
         return 0;
     } else {
+        te_free(fx);
         return 1;
     }
 }
 
+/*
+ *  Sums the points of an integration job given by a slice, each weighted
+ *  as in the trapezoidal rule (a half at either end of the bounds) and
+ *  multiplied by the segment width, in a running sum like the serial loop
+ *  it replaced. Points are evaluated PROGRAM_BLOCK at a time by the
+ *  function compiled to machine code, or the lowered function if the JIT is
+ *  not available, or one by one by a private copy of the compiled function
+ *  if it could not be lowered.
+ *  Params:
+ *      void* slicePacked - packed Slice pointer, its sum is set
+ *  Returns (void*):
+ */
+void* function_integrate_slice(void* slicePacked) {
+    // Stage
+    Slice* slice = (Slice*)slicePacked;
+    Job* job = slice->job;
+    double x;
+    Program* program;
+    Native* native;
+    te_expr* fx = expression_cache_get(job->function, &x, &program,
+            &native);
+    if (!fx) {
+        slice->sum = NAN;
+        return NULL;
+    }
+    double* registers = NULL;
+    if (program && !native) {
+        registers = malloc(sizeof(double) * PROGRAM_BLOCK * program->size);
+    }
+    double xs[PROGRAM_BLOCK], values[PROGRAM_BLOCK];
+    double segmentWidth = (job->upper - job->lower) / job->segments;
+    double sum = 0.0;
+    // Sum
+    for (int first = slice->first; first < slice->last;
+            first += PROGRAM_BLOCK) {
+        int count = slice->last - first;
+        if (count > PROGRAM_BLOCK) {
+            count = PROGRAM_BLOCK;
+        }
+        for (int i = 0; i < count; i++) {
+            if (first + i == job->segments) { // Exactly on the bound
+                xs[i] = job->upper;
+            } else {
+                xs[i] = job->lower + (first + i) * segmentWidth;
+            }
+        }
+        const double* ys = values;
+        if (native) {
+            native->function(xs, values, count);
+        } else if (program) {
+            ys = program_run(program, registers, xs, count);
+        } else {
+            for (int i = 0; i < count; i++) {
+                x = xs[i];
+                values[i] = te_eval(fx);
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            if (first + i == 0 || first + i == job->segments) {
+                sum += segmentWidth * ys[i] / 2;
+            } else {
+                sum += segmentWidth * ys[i];
+            }
+        }
+    }
+    free(registers);
+    native_release(native);
+    program_free(program);
+    te_free(fx);
+    slice->sum = sum;
+    return NULL;
+}
+
+/*
+ *  Takes the next slice of a batch nobody has taken yet, removing the batch
+ *  from the queue of integrationPool once its last slice is taken.
+ *  integrationPool.lock must be held.
+ *  Params:
+ *      SliceBatch* batch - the batch to take from
+ *  Returns (int):
+ *      index - index of the slice taken
+ *      -1 - every slice is taken already
+ */
+int slice_batch_take(SliceBatch* batch) {
+    if (batch->next == batch->count) {
+        return -1;
+    }
+    int index = batch->next++;
+    if (batch->next == batch->count) {
+        SliceBatch** link = &integrationPool.first;
+        SliceBatch* previous = NULL;
+        while (*link && *link != batch) {
+            previous = *link;
+            link = &(*link)->later;
+        }
+        if (*link) {
+            *link = batch->later;
+            if (integrationPool.last == batch) {
+                integrationPool.last = previous;
+            }
+        }
+    }
+    return index;
+}
+
+/*
+ *  Thread body of the integration pool, integrates slices from the front
+ *  batch of the queue forever
+ *  Params:
+ *      void* unused - NULL
+ *  Returns (void*):
+ */
+void* integration_worker(void* unused) {
+    pthread_mutex_lock(&integrationPool.lock);
+    while (1) {
+        while (!integrationPool.first) {
+            pthread_cond_wait(&integrationPool.waiting,
+                    &integrationPool.lock);
+        }
+        SliceBatch* batch = integrationPool.first;
+        int index = slice_batch_take(batch);
+        pthread_mutex_unlock(&integrationPool.lock);
+        function_integrate_slice(&batch->slices[index]);
+        pthread_mutex_lock(&integrationPool.lock);
+        if (++batch->done == batch->count) {
+            pthread_cond_signal(&batch->finished);
+        }
+    }
+    return NULL;
+}
+
+/*
+ *  Starts the integration pool, one thread per online CPU, shared by the
+ *  jobs of every connection. Without it jobs are integrated by the thread
+ *  asking alone.
+ *  Params:
+ *      pthread_attr_t* pthreadAttr - attributes of the threads, detached
+ *  Returns (void):
+ */
+void integration_pool_start(pthread_attr_t* pthreadAttr) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t pthread;
+    for (long i = 0; i < (cpus > 0 ? cpus : 1); i++) {
+        if (pthread_create(&pthread, pthreadAttr, integration_worker,
+                NULL)) {
+            break;
+        }
+        integrationPool.threads++;
+    }
+}
+
 /*
  *  Integrates a function of given bound with respect to x using the
- *  trapezoidal method.
+ *  trapezoidal method. The segments are split evenly into job->threads
+ *  slices, which the integration pool and the calling thread take between
+ *  them, so a job never starts threads of its own. The slice sums are added
+ *  up in slice order, so a job always gives the same result and one slice
+ *  sums the points exactly as the serial loop did.
  *  Params:
  *      Job* job - a Job* pointer
  *  Returns (double):
@@ -175,23 +780,52 @@ int function_isvalid(char* function) {
  */
 double function_integrate_trapezoidal(Job* job) {
     // Stage
-    double x;
-    te_variable variables[] = {{"x", &x}};
-    int errorPosition;
-    te_expr* fx = te_compile(job->function, variables, 1, &errorPosition);
-    // Define variables
-    double result = 0.0, segmentWidth;
-    // Find segment width
-    segmentWidth = (job->upper - job->lower) / job->segments;
-    // Integrate
-    x = job->lower;
-    result += segmentWidth * te_eval(fx);
-    for (int i = 1; i < job->segments - 1; i++) {
-        x = i * segmentWidth;
-        result += segmentWidth * 2 * te_eval(fx);
-    }
-    x = job->upper;
-    result += segmentWidth * te_eval(fx); 
+    if (job->segments < 1) {
+        return 0.0;
+    }
+    int count = job->threads;
+    if (count < 1) {
+        count = 1;
+    } else if (count > job->segments) {
+        count = job->segments;
+    }
+    SliceBatch batch = {malloc(sizeof(Slice) * count), count, 0, 0,
+            PTHREAD_COND_INITIALIZER, NULL};
+    // Split points 0 to segments between the slices
+    for (int t = 0; t < count; t++) {
+        batch.slices[t].job = job;
+        batch.slices[t].first = (long long)job->segments * t / count;
+        batch.slices[t].last = (long long)job->segments * (t + 1) / count;
+    }
+    batch.slices[count - 1].last = job->segments + 1; // The upper bound
+    // Integrate, taking slices alongside the pool until none are left
+    pthread_mutex_lock(&integrationPool.lock);
+    if (count > 1 && integrationPool.threads) {
+        if (integrationPool.last) {
+            integrationPool.last->later = &batch;
+        } else {
+            integrationPool.first = &batch;
+        }
+        integrationPool.last = &batch;
+        pthread_cond_broadcast(&integrationPool.waiting);
+    }
+    int index;
+    while ((index = slice_batch_take(&batch)) >= 0) {
+        pthread_mutex_unlock(&integrationPool.lock);
+        function_integrate_slice(&batch.slices[index]);
+        pthread_mutex_lock(&integrationPool.lock);
+        batch.done++;
+    }
+    while (batch.done < batch.count) {
+        pthread_cond_wait(&batch.finished, &integrationPool.lock);
+    }
+    pthread_mutex_unlock(&integrationPool.lock);
+    double result = batch.slices[0].sum;
+    for (int t = 1; t < count; t++) {
+        result += batch.slices[t].sum;
+    }
+    pthread_cond_destroy(&batch.finished);
+    free(batch.slices);
     // Return
     return result;
 }
@@ -299,30 +933,36 @@ char* http_request_handler(char* buffer, int bufferLen) {
 }
 
 /*
- *  Receives and sends response back to client
+ *  Receives and sends response back to client. A client sending nothing for
+ *  POOL_CLIENT_TIMEOUT seconds is dropped, so it cannot hold a worker of
+ *  the pool forever.
  *  Params:
- *      void* clientfdPacked - packed client file descriptor from accept()
+ *      int clientfd - client file descriptor from accept()
  *  Returns (void):
  */
-void* client_handler(void* clientfdPacked) {
-    // Stage
-    int clientfd = *((int*)clientfdPacked);
-    free(clientfdPacked);
+void client_handler(int clientfd) {
+    struct timeval timeout = {.tv_sec = POOL_CLIENT_TIMEOUT};
+    setsockopt(clientfd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+            sizeof(timeout));
     // Receive
     int len;
-    if (recv(clientfd, &len, sizeof(int), 0) < 0) { // Receive metadata
+    if (recv(clientfd, &len, sizeof(int), 0) <= 0) { // Receive metadata
         fprintf(stderr, "client_handler: recv() failed\n");
+        close(clientfd);
+        return;
     }
     char buffer[len];
     if (recv(clientfd, buffer, len, 0) < 0) { // Receive data
         fprintf(stderr, "client_handler: recv() failed\n");
+        close(clientfd);
+        return;
     }
     char* received;
     asprintf(&received, "%s", buffer);
     // Discard empty requests
     if (strlen(received) < 1) {
         close(clientfd);
-        return NULL;
+        return;
     }
     // Compute
     char* message = http_request_handler(received, strlen(received));
@@ -335,31 +975,165 @@ void* client_handler(void* clientfdPacked) {
         fprintf(stderr, "socket_send: send() failed\n");
     }
     close(clientfd);
+}
+
+/*
+ *  Initialises an empty connection queue
+ *  Params:
+ *      ConnectionQueue* queue - the queue to initialise
+ *      int capacity - the most connections it may hold at once
+ *  Returns (void):
+ */
+void queue_init(ConnectionQueue* queue, int capacity) {
+    queue->clientfds = malloc(sizeof(int) * capacity);
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->depth = 0;
+    queue->peakDepth = 0;
+    queue->accepted = 0;
+    queue->stalls = 0;
+    pthread_mutex_init(&queue->lock, NULL);
+    sem_init(&queue->slots, 0, capacity);
+    sem_init(&queue->items, 0, 0);
+}
+
+/*
+ *  Reserves room in the queue for one more connection, waiting for a worker
+ *  to take one off it while it is full
+ *  Params:
+ *      ConnectionQueue* queue - the queue to reserve in
+ *  Returns (void):
+ */
+void queue_reserve(ConnectionQueue* queue) {
+    if (sem_trywait(&queue->slots) == 0) {
+        return;
+    }
+    pthread_mutex_lock(&queue->lock); // Full, count the stall and wait
+    queue->stalls++;
+    pthread_mutex_unlock(&queue->lock);
+    while (sem_wait(&queue->slots) < 0 && errno == EINTR) {
+    }
+}
+
+/*
+ *  Adds a connection to the back of the queue, in the room reserved for it
+ *  by queue_reserve()
+ *  Params:
+ *      ConnectionQueue* queue - the queue to add to
+ *      int clientfd - client file descriptor from accept()
+ *  Returns (void):
+ */
+void queue_push(ConnectionQueue* queue, int clientfd) {
+    pthread_mutex_lock(&queue->lock);
+    queue->clientfds[(queue->head + queue->depth) % queue->capacity] =
+            clientfd;
+    queue->depth++;
+    if (queue->depth > queue->peakDepth) {
+        queue->peakDepth = queue->depth;
+    }
+    queue->accepted++;
+    pthread_mutex_unlock(&queue->lock);
+    sem_post(&queue->items);
+}
+
+/*
+ *  Takes the connection at the front of the queue, waiting for one if it is
+ *  empty
+ *  Params:
+ *      ConnectionQueue* queue - the queue to take from
+ *  Returns (int):
+ *      clientfd - client file descriptor from accept()
+ */
+int queue_pop(ConnectionQueue* queue) {
+    while (sem_wait(&queue->items) < 0 && errno == EINTR) {
+    }
+    pthread_mutex_lock(&queue->lock);
+    int clientfd = queue->clientfds[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->depth--;
+    pthread_mutex_unlock(&queue->lock);
+    sem_post(&queue->slots);
+    return clientfd;
+}
+
+/*
+ *  Worker thread of the pool, handles connections from the queue forever
+ *  Params:
+ *      void* queuePacked - packed ConnectionQueue pointer
+ *  Returns (void*):
+ */
+void* client_worker(void* queuePacked) {
+    ConnectionQueue* queue = (ConnectionQueue*)queuePacked;
+    while (1) {
+        client_handler(queue_pop(queue));
+    }
     return NULL;
 }
 
 /*
- *  Spawns threads to handle client accept(). Exits on error.
+ *  Prints the queue metrics to stderr every time the server gets SIGHUP.
+ *  SIGHUP must be blocked in every other thread.
  *  Params:
- *      int - socket file descriptor
- *      char* maxPorts - argument string for port
+ *      void* queuePacked - packed ConnectionQueue pointer
+ *  Returns (void*):
+ */
+void* queue_reporter(void* queuePacked) {
+    ConnectionQueue* queue = (ConnectionQueue*)queuePacked;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    int received;
+    while (!sigwait(&set, &received)) {
+        pthread_mutex_lock(&queue->lock);
+        fprintf(stderr, "Queue depth:%d/%d\n", queue->depth,
+                queue->capacity);
+        fprintf(stderr, "Peak queue depth:%d\n", queue->peakDepth);
+        fprintf(stderr, "Accepted connections:%lu\n", queue->accepted);
+        fprintf(stderr, "Accept stalls:%lu\n", queue->stalls);
+        pthread_mutex_unlock(&queue->lock);
+        fflush(stderr);
+    }
+    return NULL;
+}
+
+/*
+ *  Starts a fixed pool of worker threads and feeds them accepted clients
+ *  through a bounded queue. Accepting pauses while the queue is full, so a
+ *  burst of clients waits in the listen backlog instead of each getting a
+ *  thread. Exits on error.
+ *  Params:
+ *      int sockfd - socket file descriptor
+ *      int maxThreads - number of workers, 0 for POOL_DEFAULT_THREADS
  *  Returns (void):
  */
 void client_handler_spawner(int sockfd, int maxThreads) {
+    int workers = maxThreads ? maxThreads : POOL_DEFAULT_THREADS;
+    ConnectionQueue* queue = malloc(sizeof(ConnectionQueue));
+    queue_init(queue, workers * POOL_QUEUE_FACTOR);
+    sigset_t set; // Only queue_reporter() takes SIGHUP
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
     pthread_attr_t pthreadAttr;
     pthread_attr_init(&pthreadAttr);
     pthread_attr_setdetachstate(&pthreadAttr, PTHREAD_CREATE_DETACHED);
+    pthread_t pthread;
+    pthread_create(&pthread, &pthreadAttr, queue_reporter, queue);
+    integration_pool_start(&pthreadAttr);
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&pthread, &pthreadAttr, client_worker, queue)) {
+            fprintf(stderr, "client_handler_spawner: error\n");
+            exit(3);
+        }
+    }
     while (1) {
+        queue_reserve(queue); // Back-pressure, wait for room before accept()
         int clientfd;
         if ((clientfd = accept(sockfd, 0, 0)) < 0) {
             fprintf(stderr, "client_handler_spawner: error\n");
             exit(3);
         }
-        pthread_t* pthread = malloc(sizeof(pthread_t));
-        int* clientfdPacked = malloc(sizeof(int));
-        *clientfdPacked = clientfd;
-        pthread_create(pthread, &pthreadAttr, client_handler, 
-                clientfdPacked);
+        queue_push(queue, clientfd);
     }
 }
 